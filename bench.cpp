@@ -0,0 +1,669 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-client.h>
+#include <stdio.h>
+
+#include "include/linux-dmabuf-unstable-v1-client-protocol.h"
+#include "include/types.h"
+
+#include "src/linux-dmabuf-unstable-v1-protocol.c"
+#include "src/clock.cpp"
+#include "src/frame_trace.cpp"
+#include "src/shm_alloc.cpp"
+#include "src/udmabuf.cpp"
+#include "src/pixel_format.cpp"
+#include "src/buffer_pool.cpp"
+#include "src/pattern_fill.cpp"
+#include "src/damage.cpp"
+#include "src/scroll_render.cpp"
+#include "src/thread_pool.cpp"
+#include "src/parallel_fill.cpp"
+#include "src/global_table.cpp"
+
+/* Renderer and allocation micro-benchmarks. Every case is timed over a
+ * resolution matrix, warm-up runs are dropped and the rest are reported as
+ * JSON on stdout for comparison between builds. */
+
+#define BENCH_DEFAULT_SAMPLES 25
+#define BENCH_DEFAULT_WARMUP 3
+#define BENCH_MAX_SAMPLES 1000
+/* Rectangles fed to the damage tracker per sample */
+#define BENCH_DAMAGE_RECTS 64
+/* Globals in the synthetic registry */
+#define BENCH_REGISTRY_GLOBALS 200
+/* A scripted drag-resize: this many frames at BENCH_RESIZE_HZ from half
+ * the resolution up to all of it, then as many back down */
+#define BENCH_RESIZE_STEPS 120
+#define BENCH_RESIZE_HZ 60
+
+struct bench_resolution
+{
+    s32 width;
+    s32 height;
+};
+
+global_variable bench_resolution bench_resolutions[] =
+{
+    { 640, 480 },
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 2560, 1440 },
+    { 3840, 2160 },
+    { 7680, 4320 },
+};
+
+struct bench_context
+{
+    u32 samples;
+    u32 warmup;
+    thread_pool thread_pool;
+    wl_display *wl_display;
+    wl_shm *wl_shm;
+
+    s32 width;
+    s32 height;
+    s32 stride;
+    size_t size;
+    pool_buffer front;
+    pool_buffer back;
+    buffer_pool buffer_pool;
+    s32 offset;
+    /* Of the case being run */
+    pixel_format format;
+    /* Set by a case that could not do its work, which skips its result */
+    b8 failed;
+
+    b8 first_result;
+};
+
+typedef void bench_fn(bench_context *context);
+
+struct bench_case
+{
+    const char *name;
+    bench_fn *run;
+    /* Whether pixels and bytes per run are the whole frame */
+    b8 frame_sized;
+    b8 needs_display;
+    pixel_format format;
+};
+
+/// CASES
+
+internal void
+bench_fill(bench_context *context)
+{
+    context->offset = (context->offset + 1) % 8;
+    s32 stride = context->width * pixel_format_bytes(context->format);
+    checkerboard_fill((u8*)context->back.data, stride, 0, 0,
+        context->width, context->height, context->offset, context->format);
+}
+
+internal void
+bench_fill_parallel(bench_context *context)
+{
+    context->offset = (context->offset + 1) % 8;
+    s32 stride = context->width * pixel_format_bytes(context->format);
+    checkerboard_fill_parallel(&context->thread_pool, (u8*)context->back.data,
+        stride, context->width, context->height, context->offset, context->format);
+}
+
+internal void
+bench_scroll(bench_context *context)
+{
+    render_stats stats = {};
+    context->offset = (context->offset + 1) % 8;
+    checkerboard_scroll(&context->back, &context->front, context->offset, &stats);
+    context->back.content_offset = context->offset;
+
+    pool_buffer front = context->front;
+    context->front = context->back;
+    context->back = front;
+}
+
+/* NULL after flagging the case as failed. Closes the fd either way. */
+internal u8 *
+bench_shm_map(bench_context *context)
+{
+    int fd = allocate_shm_file(context->size);
+    if (fd == -1)
+    {
+        context->failed = true;
+        return NULL;
+    }
+    void *data = mmap(NULL, context->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        context->failed = true;
+        return NULL;
+    }
+    return (u8*)data;
+}
+
+internal void
+bench_shm_alloc(bench_context *context)
+{
+    u8 *data = bench_shm_map(context);
+    if (data)
+    {
+        munmap(data, context->size);
+    }
+}
+
+/* Allocation plus the page faults of the first frame written to it */
+internal void
+bench_shm_first_touch(bench_context *context)
+{
+    u8 *data = bench_shm_map(context);
+    if (!data)
+    {
+        return;
+    }
+    for (size_t i = 0; i < context->size; i += 4096)
+    {
+        data[i] = 0;
+    }
+    munmap(data, context->size);
+}
+
+/* Steady state: a released buffer of the right size is waiting. The
+ * release the compositor would send is simulated right away. */
+internal void
+bench_buffer_acquire(bench_context *context)
+{
+    pool_buffer *buffer = buffer_pool_acquire(&context->buffer_pool,
+        context->width, context->height);
+    if (buffer)
+    {
+        buffer->busy = false;
+    }
+}
+
+/* Cold path: a fresh pool has to create the shm file, mapping and wl_buffer */
+internal void
+bench_buffer_allocate(bench_context *context)
+{
+    buffer_pool pool;
+    buffer_pool_init(&pool, context->wl_shm, BUFFER_POOL_MIN_BUFFERS);
+    buffer_pool_acquire(&pool, context->width, context->height);
+    buffer_pool_destroy(&pool);
+}
+
+internal void
+bench_damage(bench_context *context)
+{
+    damage_region region = {};
+    u32 seed = 0x9e3779b9u + context->offset++;
+    s32 tile_w = context->width / 16;
+    s32 tile_h = context->height / 16;
+    for (u32 i = 0; i < BENCH_DAMAGE_RECTS; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        s32 x = (s32)(seed >> 8) % (context->width - tile_w);
+        seed = seed * 1664525u + 1013904223u;
+        s32 y = (s32)(seed >> 8) % (context->height - tile_h);
+        damage_region_add(&region, x, y, tile_w, tile_h);
+    }
+}
+
+/// REGISTRY
+
+/* What a desktop compositor advertises, padded with made-up names up to
+ * BENCH_REGISTRY_GLOBALS */
+global_variable const char *bench_registry_names[] =
+{
+    "wl_compositor", "wl_subcompositor", "wl_shm", "wl_data_device_manager",
+    "wl_seat", "wl_output", "xdg_wm_base", "zxdg_decoration_manager_v1",
+    "zxdg_output_manager_v1", "wp_presentation", "wp_viewporter",
+    "wp_fractional_scale_manager_v1", "wp_cursor_shape_manager_v1",
+    "wp_single_pixel_buffer_manager_v1", "wp_content_type_manager_v1",
+    "wp_tearing_control_manager_v1", "wp_drm_lease_device_v1",
+    "wp_security_context_manager_v1", "zwp_linux_dmabuf_v1",
+    "zwp_relative_pointer_manager_v1", "zwp_pointer_constraints_v1",
+    "zwp_pointer_gestures_v1", "zwp_tablet_manager_v2", "zwp_text_input_manager_v3",
+    "zwp_input_method_manager_v2", "zwp_virtual_keyboard_manager_v1",
+    "zwp_idle_inhibit_manager_v1", "zwp_primary_selection_device_manager_v1",
+    "zwp_keyboard_shortcuts_inhibit_manager_v1", "xdg_activation_v1",
+    "zwlr_layer_shell_v1", "zwlr_output_manager_v1", "zwlr_screencopy_manager_v1",
+    "zwlr_data_control_manager_v1", "zwlr_gamma_control_manager_v1",
+    "zwlr_foreign_toplevel_manager_v1", "zwlr_export_dmabuf_manager_v1",
+    "zwlr_virtual_pointer_manager_v1", "ext_idle_notifier_v1",
+    "ext_session_lock_manager_v1", "ext_foreign_toplevel_list_v1",
+    "org_kde_kwin_server_decoration_manager", "wl_drm",
+};
+
+/* Binding more of the registry than the client does today */
+internal void
+bench_bind_global(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    ++*(u32*)data;
+}
+
+global_variable constexpr global_binding bench_global_bindings[] =
+{
+    { "wl_compositor", NULL, 1, 6, bench_bind_global },
+    { "wl_subcompositor", NULL, 1, 1, bench_bind_global },
+    { "wl_shm", NULL, 1, 1, bench_bind_global },
+    { "wl_data_device_manager", NULL, 1, 3, bench_bind_global },
+    { "wl_seat", NULL, 1, 9, bench_bind_global },
+    { "wl_output", NULL, 1, 4, bench_bind_global },
+    { "xdg_wm_base", NULL, 1, 6, bench_bind_global },
+    { "zxdg_decoration_manager_v1", NULL, 1, 1, bench_bind_global },
+    { "zxdg_output_manager_v1", NULL, 1, 3, bench_bind_global },
+    { "wp_presentation", NULL, 1, 1, bench_bind_global },
+    { "wp_viewporter", NULL, 1, 1, bench_bind_global },
+    { "wp_fractional_scale_manager_v1", NULL, 1, 1, bench_bind_global },
+    { "wp_cursor_shape_manager_v1", NULL, 1, 1, bench_bind_global },
+    { "zwp_linux_dmabuf_v1", NULL, 1, 4, bench_bind_global },
+    { "zwp_relative_pointer_manager_v1", NULL, 1, 1, bench_bind_global },
+    { "zwp_pointer_constraints_v1", NULL, 1, 1, bench_bind_global },
+    { "zwp_text_input_manager_v3", NULL, 1, 1, bench_bind_global },
+    { "zwp_primary_selection_device_manager_v1", NULL, 1, 1, bench_bind_global },
+    { "xdg_activation_v1", NULL, 1, 1, bench_bind_global },
+    { "ext_idle_notifier_v1", NULL, 1, 1, bench_bind_global },
+};
+
+global_variable constexpr auto bench_globals = global_table_build(bench_global_bindings);
+
+global_variable char bench_registry[BENCH_REGISTRY_GLOBALS][64];
+
+internal void
+bench_registry_init(void)
+{
+    u32 real = sizeof(bench_registry_names) / sizeof(bench_registry_names[0]);
+    for (u32 i = 0; i < BENCH_REGISTRY_GLOBALS; ++i)
+    {
+        if (i < real)
+        {
+            snprintf(bench_registry[i], sizeof(bench_registry[i]), "%s", bench_registry_names[i]);
+        }
+        else
+        {
+            snprintf(bench_registry[i], sizeof(bench_registry[i]), "zext_synthetic_global_%u_v1", i);
+        }
+    }
+}
+
+/* What registry_global did before the table, one strcmp per binding */
+internal void
+bench_registry_strcmp(bench_context *context)
+{
+    u32 bound = 0;
+    u32 count = sizeof(bench_global_bindings) / sizeof(bench_global_bindings[0]);
+    for (u32 i = 0; i < BENCH_REGISTRY_GLOBALS; ++i)
+    {
+        for (u32 j = 0; j < count; ++j)
+        {
+            if (strcmp(bench_registry[i], bench_global_bindings[j].name) == 0)
+            {
+                bench_global_bindings[j].bind(&bound, NULL, i, 1);
+                break;
+            }
+        }
+    }
+    context->offset += bound;
+}
+
+internal void
+bench_registry_table(bench_context *context)
+{
+    u32 bound = 0;
+    for (u32 i = 0; i < BENCH_REGISTRY_GLOBALS; ++i)
+    {
+        global_table_dispatch(&bench_globals, &bound, NULL, i, bench_registry[i], 1);
+    }
+    context->offset += bound;
+}
+
+global_variable bench_case bench_registry_cases[] =
+{
+    { "registry_strcmp", bench_registry_strcmp, false, false },
+    { "registry_table", bench_registry_table, false, false },
+};
+
+global_variable bench_case bench_cases[] =
+{
+    { "fill", bench_fill, true, false },
+    { "fill_parallel", bench_fill_parallel, true, false },
+    { "fill_rgb565", bench_fill, true, false, PIXEL_FORMAT_RGB565 },
+    { "fill_parallel_rgb565", bench_fill_parallel, true, false, PIXEL_FORMAT_RGB565 },
+    { "scroll", bench_scroll, true, false },
+    { "shm_alloc", bench_shm_alloc, true, false },
+    { "shm_first_touch", bench_shm_first_touch, true, false },
+    { "buffer_acquire", bench_buffer_acquire, false, true },
+    { "buffer_allocate", bench_buffer_allocate, true, true },
+    { "damage", bench_damage, false, false },
+};
+
+/// RESIZE
+
+/* Runs the drag script against a fresh pool, the compositor releasing
+ * each frame as soon as the next one replaces it */
+internal void
+bench_resize_drag(bench_context *context, buffer_pool *pool)
+{
+    s32 min_w = context->width / 2;
+    s32 min_h = context->height / 2;
+    pool_buffer *shown = NULL;
+    for (u32 step = 0; step <= 2 * BENCH_RESIZE_STEPS; ++step)
+    {
+        u32 t = step <= BENCH_RESIZE_STEPS ? step : 2 * BENCH_RESIZE_STEPS - step;
+        s32 width = min_w + (context->width - min_w) * (s32)t / BENCH_RESIZE_STEPS;
+        s32 height = min_h + (context->height - min_h) * (s32)t / BENCH_RESIZE_STEPS;
+        pool_buffer *buffer = buffer_pool_acquire(pool, width, height);
+        if (shown)
+        {
+            shown->busy = false;
+        }
+        shown = buffer;
+    }
+}
+
+/* Allocations per second are per second of the drag as the user sees it,
+ * i.e. at BENCH_RESIZE_HZ, not of the time the pool took */
+internal void
+bench_run_resize(bench_context *context, const char *name, b8 exact_size)
+{
+    local_persist u64 samples[BENCH_MAX_SAMPLES];
+    buffer_pool_stats stats = {};
+    for (u32 i = 0; i < context->warmup + context->samples; ++i)
+    {
+        buffer_pool pool;
+        buffer_pool_init(&pool, context->wl_shm, BUFFER_POOL_MIN_BUFFERS);
+        pool.exact_size = exact_size;
+        u64 start = clock_ns();
+        bench_resize_drag(context, &pool);
+        u64 elapsed = clock_ns() - start;
+        stats = pool.stats;
+        buffer_pool_destroy(&pool);
+        if (i >= context->warmup)
+        {
+            samples[i - context->warmup] = elapsed;
+        }
+    }
+    qsort(samples, context->samples, sizeof(samples[0]), compare_u64);
+
+    u32 frames = 2 * BENCH_RESIZE_STEPS + 1;
+    f64 drag_seconds = (f64)frames / BENCH_RESIZE_HZ;
+    printf("%s\n    {\"case\": \"%s\", \"width\": %d, \"height\": %d, "
+        "\"median_ns\": %llu, \"frames\": %u, \"allocations\": %llu, "
+        "\"reshapes\": %llu, \"mib_allocated\": %.1f, \"allocations_per_sec\": %.1f}",
+        context->first_result ? "" : ",",
+        name, context->width, context->height,
+        (unsigned long long)samples[context->samples / 2],
+        frames,
+        (unsigned long long)stats.allocations,
+        (unsigned long long)stats.reshapes,
+        stats.bytes_allocated / (1024.0 * 1024.0),
+        stats.allocations / drag_seconds
+    );
+    context->first_result = false;
+}
+
+/// SETUP
+
+internal b8
+bench_map_buffer(pool_buffer *buffer, s32 width, s32 height)
+{
+    *buffer = {};
+    buffer->width = width;
+    buffer->height = height;
+    buffer->stride = width * 4;
+    buffer->size = (size_t)buffer->stride * height;
+
+    int fd = allocate_shm_file(buffer->size);
+    if (fd == -1)
+    {
+        return false;
+    }
+    buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buffer->data == MAP_FAILED)
+    {
+        buffer->data = NULL;
+        return false;
+    }
+    return true;
+}
+
+internal void
+bench_unmap_buffer(pool_buffer *buffer)
+{
+    if (buffer->data)
+    {
+        munmap(buffer->data, buffer->size);
+    }
+    *buffer = {};
+}
+
+/// REPORT
+
+internal void
+bench_run_case(bench_context *context, bench_case *bench)
+{
+    local_persist u64 samples[BENCH_MAX_SAMPLES];
+    context->format = bench->format;
+    context->failed = false;
+    for (u32 i = 0; i < context->warmup + context->samples && !context->failed; ++i)
+    {
+        u64 start = clock_ns();
+        bench->run(context);
+        if (i >= context->warmup)
+        {
+            samples[i - context->warmup] = clock_ns() - start;
+        }
+    }
+    if (context->failed)
+    {
+        fprintf(stderr, "bench: %s failed at %dx%d: %s\n",
+            bench->name, context->width, context->height, strerror(errno));
+        return;
+    }
+    qsort(samples, context->samples, sizeof(samples[0]), compare_u64);
+
+    u64 median = samples[context->samples / 2];
+    u64 p99 = samples[(context->samples - 1) * 99 / 100];
+    f64 seconds = median > 0 ? median / 1e9 : 1e-9;
+    u64 pixels = bench->frame_sized ? (u64)context->width * context->height : 0;
+    u64 bytes = pixels * pixel_format_bytes(bench->format);
+
+    printf("%s\n    {\"case\": \"%s\", \"width\": %d, \"height\": %d, "
+        "\"median_ns\": %llu, \"p99_ns\": %llu, \"min_ns\": %llu, "
+        "\"runs_per_sec\": %.1f, \"pixels_per_sec\": %.0f, \"bytes_per_sec\": %.0f}",
+        context->first_result ? "" : ",",
+        bench->name, context->width, context->height,
+        (unsigned long long)median,
+        (unsigned long long)p99,
+        (unsigned long long)samples[0],
+        1.0 / seconds,
+        pixels / seconds,
+        bytes / seconds
+    );
+    context->first_result = false;
+}
+
+internal void
+bench_run_resolution(bench_context *context, s32 width, s32 height)
+{
+    context->width = width;
+    context->height = height;
+    context->stride = width * 4;
+    context->size = (size_t)context->stride * height;
+    context->offset = 0;
+
+    if (!bench_map_buffer(&context->front, width, height) ||
+        !bench_map_buffer(&context->back, width, height))
+    {
+        fprintf(stderr, "bench: could not map %dx%d buffers\n", width, height);
+        bench_unmap_buffer(&context->front);
+        bench_unmap_buffer(&context->back);
+        return;
+    }
+    checkerboard_fill((u8*)context->front.data, context->stride, 0, 0, width, height, 0,
+        PIXEL_FORMAT_XRGB8888);
+    context->front.content_offset = 0;
+    checkerboard_fill((u8*)context->back.data, context->stride, 0, 0, width, height, 0,
+        PIXEL_FORMAT_XRGB8888);
+    context->back.content_offset = 0;
+    if (context->wl_shm)
+    {
+        buffer_pool_init(&context->buffer_pool, context->wl_shm, BUFFER_POOL_MIN_BUFFERS);
+    }
+
+    for (u32 i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); ++i)
+    {
+        bench_case *bench = &bench_cases[i];
+        if (bench->needs_display && !context->wl_shm)
+        {
+            continue;
+        }
+        bench_run_case(context, bench);
+    }
+
+    if (context->wl_shm)
+    {
+        buffer_pool_destroy(&context->buffer_pool);
+        bench_run_resize(context, "resize_exact", true);
+        bench_run_resize(context, "resize_geometric", false);
+    }
+    bench_unmap_buffer(&context->front);
+    bench_unmap_buffer(&context->back);
+}
+
+internal void
+bench_registry_global(void *data, wl_registry *registry, u32 name,
+    const char *interface, u32 version)
+{
+    bench_context *context = (bench_context*)data;
+    if (strcmp(interface, wl_shm_interface.name) == 0)
+    {
+        context->wl_shm = (wl_shm*)wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    }
+}
+
+internal void
+bench_registry_global_remove(void *data, wl_registry *registry, u32 name)
+{
+    // empty
+}
+
+global_variable wl_registry_listener bench_registry_listener =
+{
+    .global = bench_registry_global,
+    .global_remove = bench_registry_global_remove,
+};
+
+int
+main(int argc, char **argv)
+{
+    bench_context context = {};
+    context.samples = BENCH_DEFAULT_SAMPLES;
+    context.warmup = BENCH_DEFAULT_WARMUP;
+    context.first_result = true;
+
+    u32 thread_count = 0;
+    s32 max_width = 0;
+    b8 verify_only = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+        {
+            context.samples = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+        {
+            context.warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-width") == 0 && i + 1 < argc)
+        {
+            max_width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            verify_only = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--samples n] [--warmup n] [--threads n] "
+                "[--max-width n] [--verify]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (context.samples < 1)
+    {
+        context.samples = 1;
+    }
+    else if (context.samples > BENCH_MAX_SAMPLES)
+    {
+        context.samples = BENCH_MAX_SAMPLES;
+    }
+
+    pattern_fill_init();
+    /* Timing a kernel that draws the wrong pattern would be meaningless */
+    if (!pattern_fill_verify())
+    {
+        return 1;
+    }
+    /* make check: only whether every kernel draws the scalar pattern */
+    if (verify_only)
+    {
+        fprintf(stderr, "bench: fill kernels match the scalar reference\n");
+        return 0;
+    }
+    thread_pool_init(&context.thread_pool, thread_count);
+
+    /* The buffer pool cases need a compositor for wl_shm, e.g. out/server */
+    context.wl_display = wl_display_connect(NULL);
+    if (context.wl_display)
+    {
+        wl_registry *registry = wl_display_get_registry(context.wl_display);
+        wl_registry_add_listener(registry, &bench_registry_listener, &context);
+        wl_display_roundtrip(context.wl_display);
+    }
+    else
+    {
+        fprintf(stderr, "bench: no Wayland display, skipping buffer pool cases\n");
+    }
+
+    printf("{\n  \"kernel\": \"%s\",\n  \"threads\": %u,\n  \"samples\": %u,\n"
+        "  \"warmup\": %u,\n  \"results\": [",
+        pattern_span_name, context.thread_pool.thread_count,
+        context.samples, context.warmup);
+    for (u32 i = 0; i < sizeof(bench_resolutions) / sizeof(bench_resolutions[0]); ++i)
+    {
+        bench_resolution *resolution = &bench_resolutions[i];
+        if (max_width && resolution->width > max_width)
+        {
+            continue;
+        }
+        bench_run_resolution(&context, resolution->width, resolution->height);
+        if (context.wl_display)
+        {
+            /* Let the compositor drop the buffers destroyed along the way */
+            wl_display_roundtrip(context.wl_display);
+        }
+    }
+
+    /* Resolution independent, reported with a 0x0 size */
+    bench_registry_init();
+    context.width = 0;
+    context.height = 0;
+    for (u32 i = 0; i < sizeof(bench_registry_cases) / sizeof(bench_registry_cases[0]); ++i)
+    {
+        bench_run_case(&context, &bench_registry_cases[i]);
+    }
+    printf("\n  ]\n}\n");
+
+    thread_pool_destroy(&context.thread_pool);
+    if (context.wl_display)
+    {
+        wl_display_disconnect(context.wl_display);
+    }
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <limits.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wayland-client.h>
 #include <stdio.h>
@@ -7,42 +8,40 @@
 #include <assert.h>
 
 #include "include/xdg-shell-client-protocol.h"
+#include "include/presentation-time-client-protocol.h"
+#include "include/viewporter-client-protocol.h"
+#include "include/linux-dmabuf-unstable-v1-client-protocol.h"
 #include "include/types.h"
 
 #include "src/xdg-shell-protocol.c"
+#include "src/presentation-time-protocol.c"
+#include "src/viewporter-protocol.c"
+#include "src/linux-dmabuf-unstable-v1-protocol.c"
+#include "src/clock.cpp"
+#include "src/frame_trace.cpp"
+#include "src/frame_time.cpp"
 #include "src/shm_alloc.cpp"
-
-struct pointer_event 
-{
-    u32 event_mask;
-    wl_fixed_t surface_x;
-    wl_fixed_t surface_y;
-    u32 button;
-    u32 state;
-    u32 time;
-    u32 serial;
-    struct
-    {
-        b8 valid;
-        wl_fixed_t value;
-        s32 discrete;
-    } axes[2];
-    u32 axis_source;
-};
-
-u8 *axis_name[2] = 
-{
-    [WL_POINTER_AXIS_VERTICAL_SCROLL] = (u8*)"vertical",
-    [WL_POINTER_AXIS_HORIZONTAL_SCROLL] = (u8*)"horizontal",
-};
-
-u8 *axis_source[4] = 
-{
-    [WL_POINTER_AXIS_SOURCE_WHEEL] = (u8*)"wheel",
-    [WL_POINTER_AXIS_SOURCE_FINGER] = (u8*)"finger",
-    [WL_POINTER_AXIS_SOURCE_CONTINUOUS] = (u8*)"continuous",
-    [WL_POINTER_AXIS_SOURCE_WHEEL_TILT] = (u8*)"wheel tilt",
-};
+#include "src/udmabuf.cpp"
+#include "src/pixel_format.cpp"
+#include "src/buffer_pool.cpp"
+#include "src/pattern_fill.cpp"
+#include "src/damage.cpp"
+#include "src/scroll_render.cpp"
+#include "src/thread_pool.cpp"
+#include "src/parallel_fill.cpp"
+#include "src/frame_cache.cpp"
+#include "src/presentation.cpp"
+#include "src/render_scale.cpp"
+#include "src/render_backend.cpp"
+#include "src/offscreen_backend.cpp"
+#include "src/global_table.cpp"
+#include "src/event_loop.cpp"
+#include "src/key_repeat.cpp"
+#include "src/event_log_record.cpp"
+#include "src/input_queue.cpp"
+#include "src/event_log.cpp"
+#include "src/keymap_cache.cpp"
+#include "src/key_table.cpp"
 
 /* Wayland code */
 struct client_state {
@@ -53,6 +52,15 @@ struct client_state {
     wl_compositor *wl_compositor;
     xdg_wm_base *xdg_wm_base;
     wl_seat *wl_seat;
+    wp_presentation *wp_presentation;
+    /* From wp_presentation.clock_id, which arrives with the bind */
+    clockid_t presentation_clock;
+    wp_viewporter *wp_viewporter;
+    zwp_linux_dmabuf_v1 *linux_dmabuf;
+    /* Bit per pixel_format, from wl_shm.format */
+    u32 shm_formats;
+    /* Bit per pixel_format the compositor imports as a linear dmabuf */
+    u32 dmabuf_formats;
     /* Objects */
     wl_surface *wl_surface;
     xdg_surface *xdg_surface;
@@ -61,100 +69,148 @@ struct client_state {
     wl_pointer *wl_pointer;
     wl_touch *wl_touch;
 
+    render_backend backend;
+    surface_backend surface_backend;
+    offscreen_backend offscreen_backend;
+    thread_pool thread_pool;
+    damage_region damage;
+    render_mode render_mode;
+    render_stats render_stats;
+    render_scale render_scale;
+    frame_time_stats frame_time;
+    b8 print_render_stats;
+    event_loop event_loop;
+    key_repeat key_repeat;
+    /* Last committed buffer and what it shows, at the render scale */
+    pool_buffer *front_buffer;
+    s32 content_offset;
+    u32 content_width;
+    u32 content_height;
     f32 offset;
     u32 last_frame;
+    /* Accumulated until wl_pointer.frame, then queued as one event */
     pointer_event pointer_event;
-    xkb_state *xkb_state;
+    input_queue input_queue;
+    /* Owned by the input queue's consumer thread */
     xkb_context *xkb_context;
+    keymap_cache keymap_cache;
+    xkb_state *xkb_state;
     xkb_keymap *xkb_keymap;
+    key_tables key_tables;
     u32 width;
     u32 height;
+    /* Latest xdg configure, acked at the end of the loop iteration */
+    u32 pending_width;
+    u32 pending_height;
+    u32 configure_serial;
+    b8 configure_pending;
+    b8 configured;
+    u64 configures_received;
+    u64 configures_applied;
     b8 closed;
 };
 
-enum pointer_event_mask 
-{
-    POINTER_EVENT_ENTER     = 1 << 0,
-    POINTER_EVENT_LEAVE     = 1 << 1,
-    POINTER_EVENT_MOTION    = 1 << 2,
-    POINTER_EVENT_BUTTON    = 1 << 3,
-    POINTER_EVENT_AXIS      = 1 << 4,
-    POINTER_EVENT_AXIS_SOURCE   = 1 << 5,
-    POINTER_EVENT_AXIS_STOP     = 1 << 6,
-    POINTER_EVENT_AXIS_DISCRETE = 1 << 7,
-};
-
-internal void
-wl_buffer_release(void *data, wl_buffer *wl_buffer)
-{
-    (void)data;
-    wl_buffer_destroy(wl_buffer);
-}
-
-global_variable wl_buffer_listener wl_buffer_listener = {
-    .release = wl_buffer_release,
-};
-
-internal wl_buffer *
+/* Returns NULL when the presented content is already up to date or when
+ * the backend has no free buffer. The buffer is width x height scaled by
+ * the render scale and shown at width x height. */
+internal pool_buffer *
 draw_frame(client_state *state)
 {
-    int width = state->width;
-    int height = state->height;
-    int stride = width * 4;
-    int size = stride * height;
+    int width = render_scale_size(&state->render_scale, state->width);
+    int height = render_scale_size(&state->render_scale, state->height);
+    int offset = (int)state->offset % 8;
 
-    int fd = allocate_shm_file(size);
-    if (fd == -1) {
+    if (state->content_offset == offset &&
+        state->content_width == (u32)width &&
+        state->content_height == (u32)height)
+    {
         return NULL;
     }
 
-    u32 *data = (u32*)mmap(
-        NULL,
-        size,
-        PROT_READ | PROT_WRITE,
-        MAP_SHARED,
-        fd,
-        0
-    );
-
-    if (data == MAP_FAILED)
+    pool_buffer *buffer = state->backend.acquire(state->backend.data, width, height, offset);
+    if (!buffer)
     {
-        close(fd);
         return NULL;
     }
 
-    wl_shm_pool *pool = wl_shm_create_pool(state->wl_shm, fd, size);
-    wl_buffer *buffer = wl_shm_pool_create_buffer(
-        pool,
-        0,
-        width,
-        height,
-        stride,
-        WL_SHM_FORMAT_XRGB8888
-    );
-
-    //TODO: why is this destroyed and closed here
-    wl_shm_pool_destroy(pool); 
-    close(fd);
-
     /* Draw checkerboxed background */
-    int offset = (int)state->offset % 8;
-    for (int y = 0; y < height; ++y) 
+    pool_buffer *front = state->front_buffer;
+    u64 raster_start = clock_ns();
+    if (buffer->content_offset == offset)
     {
-        for (int x = 0; x < width; ++x) 
-        {
-            if (((x + offset) + ( y + offset) / 8 * 8) % 16 < 8)
-                data[y * width + x] = 0xFF666666;
-            else
-                data[y * width + x] = 0xFFEEEEEE;
-        }
+        render_stats_frame(&state->render_stats, 0, 0);
+    }
+    else if (state->render_mode == RENDER_MODE_SCROLL && front &&
+        front->content_offset >= 0 &&
+        front->width == width && front->height == height)
+    {
+        checkerboard_scroll(buffer, front, offset, &state->render_stats);
+        TRACE_FRAME_STAGE(FRAME_STAGE_RASTER);
+    }
+    else
+    {
+        checkerboard_fill_parallel(&state->thread_pool, (u8*)buffer->data,
+            buffer->stride, width, height, offset, buffer->format);
+        render_stats_frame(&state->render_stats, (u64)width * height, 0);
+        TRACE_FRAME_STAGE(FRAME_STAGE_RASTER);
+    }
+    damage_region_add(&state->damage, 0, 0, width, height);
+    if (buffer->content_offset != offset)
+    {
+        render_scale_record(&state->render_scale, clock_ns() - raster_start,
+            state->backend.refresh_interval(state->backend.data));
+    }
+    if (state->backend.set_destination)
+    {
+        state->backend.set_destination(state->backend.data, state->width, state->height);
+    }
+
+    if (state->print_render_stats)
+    {
+        fprintf(stderr, "frame %llu: %llu pixels rasterized, %llu copied\n",
+            (unsigned long long)state->render_stats.frames,
+            (unsigned long long)state->render_stats.last_rasterized,
+            (unsigned long long)state->render_stats.last_copied
+        );
     }
 
-    munmap(data, size);
-    wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL);
+    buffer->content_offset = offset;
+    state->front_buffer = buffer;
+    state->content_offset = offset;
+    state->content_width = width;
+    state->content_height = height;
     return buffer;
 }
 
+/* Presents even when nothing was drawn, the backend decides what an
+ * unchanged frame means */
+internal void
+submit_frame(client_state *state)
+{
+    TRACE_FRAME_BEGIN();
+    u64 start = clock_ns();
+    pool_buffer *buffer = draw_frame(state);
+    state->backend.present(state->backend.data, buffer, &state->damage);
+    TRACE_FRAME_END();
+    frame_time_record(&state->frame_time, clock_ns() - start);
+}
+
+/* Advances the animation to `time`, in ms, and submits a frame */
+internal void
+client_frame(void *data, u32 time)
+{
+    client_state *state = (client_state*)data;
+    if (state->last_frame != 0)
+    {
+        s32 elapsed = time - state->last_frame;
+        state->offset += elapsed / 1000.0 * 24;
+    }
+
+    submit_frame(state);
+
+    state->last_frame = time;
+}
+
 internal void
 wl_surface_frame_done(void *data, wl_callback *cb, u32);
 
@@ -163,6 +219,29 @@ global_variable wl_callback_listener wl_surface_frame_listener =
     .done = wl_surface_frame_done,
 };
 
+/* Acks only the latest of the configures received since the last call,
+ * which the protocol allows, and takes on its size. Called once per event
+ * loop iteration, so a stream of configures during an interactive resize
+ * is acked once per batch. The redraw at the new size waits for the next
+ * frame callback, but the ack does not: hidden surfaces get no frame
+ * callbacks and their configures must still be answered. */
+internal void
+apply_configure(client_state *state)
+{
+    if (!state->configure_pending)
+    {
+        return;
+    }
+    xdg_surface_ack_configure(state->xdg_surface, state->configure_serial);
+    if (state->pending_width != 0 && state->pending_height != 0)
+    {
+        state->width = state->pending_width;
+        state->height = state->pending_height;
+    }
+    state->configure_pending = false;
+    ++state->configures_applied;
+}
+
 internal void
 wl_surface_frame_done(void *data, wl_callback *cb, u32 time)
 {
@@ -172,114 +251,278 @@ wl_surface_frame_done(void *data, wl_callback *cb, u32 time)
     cb = wl_surface_frame(state->wl_surface);
     wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
 
-    if (state->last_frame != 0)
+    /* Nothing may be attached before the first configure is acked */
+    if (!state->configured)
     {
-        s32 elapsed = time - state->last_frame;
-        state->offset += elapsed / 1000.0 * 24;
+        return;
     }
-
-    wl_buffer *buffer = draw_frame(state);
-    wl_surface_attach(state->wl_surface, buffer, 0, 0);
-    wl_surface_damage(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
-    wl_surface_commit(state->wl_surface);
-
-    state->last_frame = time;
+    client_frame(state, time);
 }
 
+/* The first configure is answered and drawn right away, since the
+ * surface is not mapped before that. Later ones only record the latest
+ * state for apply_configure at the end of the loop iteration. */
 internal void
 xdg_surface_configure(void *data, xdg_surface *xdg_surface, u32 serial)
 {
     client_state *state = (client_state*)data;
-    xdg_surface_ack_configure(xdg_surface, serial);
+    state->configure_serial = serial;
+    state->configure_pending = true;
+    ++state->configures_received;
 
-    wl_buffer *buffer = draw_frame(state);
-    wl_surface_attach(state->wl_surface, buffer, 0, 0);
-    wl_surface_commit(state->wl_surface);
+    if (!state->configured)
+    {
+        state->configured = true;
+        apply_configure(state);
+        submit_frame(state);
+    }
 }
 
 global_variable xdg_surface_listener xdg_surface_listener = {
     .configure = xdg_surface_configure,
 };
 
-/// KEYBOARD
+/// INPUT
+/* Everything below runs on the input queue's consumer thread */
 
 internal void
-wl_keyboard_keymap(void *data, wl_keyboard *wl_keyboard, u32 format, s32 fd, u32 size)
+input_log_key(client_state *state, event_log_type type, u32 time, u32 key, u32 key_state)
+{
+    event_log_record *record = event_log_begin(type);
+    if (record)
+    {
+        key_table_entry *entry = key_tables_lookup(&state->key_tables, state->xkb_state, key + 8);
+        record->fields[0] = time;
+        record->fields[1] = key;
+        record->fields[2] = key_state;
+        record->fields[3] = entry->sym;
+        memcpy(&record->fields[4], entry->utf8, sizeof(entry->utf8));
+        event_log_commit();
+    }
+}
+
+internal void
+input_log_pointer_frame(pointer_event *event)
+{
+    event_log_record *record = event_log_begin(EVENT_LOG_POINTER_FRAME);
+    if (record)
+    {
+        record->fields[0] = event->time;
+        record->fields[1] = event->event_mask;
+        record->fields[2] = event->surface_x;
+        record->fields[3] = event->surface_y;
+        record->fields[4] = event->button;
+        record->fields[5] = event->state;
+        record->fields[6] = event->axis_source;
+        record->fields[7] = event->axes[0].valid | event->axes[1].valid << 1;
+        record->fields[8] = event->axes[0].value;
+        record->fields[9] = event->axes[0].discrete;
+        record->fields[10] = event->axes[1].value;
+        record->fields[11] = event->axes[1].discrete;
+        event_log_commit();
+    }
+}
+
+internal void
+input_process_batch(void *data, input_event *events, u32 count)
 {
     client_state *state = (client_state*)data;
-    u8 *map_shm = (u8*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    for (u32 i = 0; i < count; ++i)
+    {
+        input_event *event = &events[i];
+        switch (event->type)
+        {
+            case INPUT_EVENT_POINTER_FRAME:
+            {
+                input_log_pointer_frame(&event->pointer);
+            } break;
 
-    xkb_keymap *xkb_keymap = xkb_keymap_new_from_string(
-        state->xkb_context,
-        (const char*)map_shm,
-        XKB_KEYMAP_FORMAT_TEXT_V1,
-        XKB_KEYMAP_COMPILE_NO_FLAGS
-    );
-    munmap(map_shm, size);
-    close(fd);
+            case INPUT_EVENT_KEYMAP:
+            {
+                keymap_cache_entry *entry = keymap_cache_lookup(&state->keymap_cache,
+                    event->keymap.text, event->keymap.size);
+                munmap(event->keymap.text, event->keymap.size);
+                if (entry)
+                {
+                    key_repeat_set_keys(&state->key_repeat, entry->metadata.repeats);
+                    xkb_state_unref(state->xkb_state);
+                    xkb_keymap_unref(state->xkb_keymap);
+                    state->xkb_keymap = xkb_keymap_ref(entry->keymap);
+                    state->xkb_state = xkb_state_new(entry->keymap);
+                    key_tables_reset(&state->key_tables);
+                    key_tables_update(&state->key_tables, state->xkb_state);
+                }
+            } break;
+
+            case INPUT_EVENT_KEYBOARD_ENTER:
+            {
+                if (event_log_begin(EVENT_LOG_KEYBOARD_ENTER))
+                {
+                    event_log_commit();
+                }
+            } break;
+
+            case INPUT_EVENT_KEYBOARD_ENTER_KEY:
+            {
+                if (state->xkb_state)
+                {
+                    input_log_key(state, EVENT_LOG_KEYBOARD_ENTER_KEY, 0,
+                        event->key.key, WL_KEYBOARD_KEY_STATE_PRESSED);
+                }
+            } break;
 
-    xkb_keymap_unref(state->xkb_keymap);
-    xkb_state_unref(state->xkb_state);
+            case INPUT_EVENT_KEYBOARD_LEAVE:
+            {
+                if (event_log_begin(EVENT_LOG_KEYBOARD_LEAVE))
+                {
+                    event_log_commit();
+                }
+            } break;
 
-    xkb_state *xkb_state = xkb_state_new(xkb_keymap);
-    state->xkb_keymap = xkb_keymap;
-    state->xkb_state = xkb_state;
+            case INPUT_EVENT_KEY:
+            {
+                if (state->xkb_state)
+                {
+                    input_log_key(state, EVENT_LOG_KEY, event->key.time,
+                        event->key.key, event->key.state);
+                }
+            } break;
 
+            case INPUT_EVENT_KEY_REPEAT:
+            {
+                if (state->xkb_state)
+                {
+                    input_log_key(state, EVENT_LOG_KEY_REPEAT, event->key.time,
+                        event->key.key, WL_KEYBOARD_KEY_STATE_PRESSED);
+                }
+            } break;
+
+            case INPUT_EVENT_MODIFIERS:
+            {
+                if (state->xkb_state)
+                {
+                    xkb_state_update_mask(state->xkb_state,
+                        event->modifiers.depressed,
+                        event->modifiers.latched,
+                        event->modifiers.locked,
+                        0, 0, event->modifiers.group
+                    );
+                    key_tables_update(&state->key_tables, state->xkb_state);
+                }
+            } break;
+        }
+    }
+}
+
+/// KEYBOARD
+
+internal void
+wl_keyboard_keymap(void *data, wl_keyboard *wl_keyboard, u32 format, s32 fd, u32 size)
+{
+    client_state *state = (client_state*)data;
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1)
+    {
+        close(fd);
+        return;
+    }
+    u8 *map_shm = (u8*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map_shm == MAP_FAILED)
+    {
+        return;
+    }
+
+    /* Compiling, or finding it in the keymap cache, is left to the
+     * consumer so dispatch is not held up */
+    input_event event = {};
+    event.type = INPUT_EVENT_KEYMAP;
+    event.keymap.text = map_shm;
+    event.keymap.size = size;
+    if (!input_queue_push(&state->input_queue, &event))
+    {
+        munmap(map_shm, size);
+    }
 }
 
 internal void
 wl_keyboard_enter(void *data, wl_keyboard *wl_keyboard, u32 serial, wl_surface *surface, wl_array *keys)
 {
     client_state *state = (client_state*)data;
-    printf("keyboard enter; keys pressed are:\n");
+    input_event event = {};
+    event.type = INPUT_EVENT_KEYBOARD_ENTER;
+    input_queue_push(&state->input_queue, &event);
 
     u32 *key;
     wl_array_for_each(key, keys)
     {
-        char buf[128];
-        xkb_keysym_t sym = xkb_state_key_get_one_sym( state->xkb_state, *key + 8);
-        xkb_keysym_get_name(sym, buf, sizeof(buf));
-        printf("sym: %-12s (%d),", buf, sym);
-        xkb_state_key_get_utf8(state->xkb_state, *key + 8, buf, sizeof(buf));
-        printf("utf8: '%s\n'", buf);
+        event.type = INPUT_EVENT_KEYBOARD_ENTER_KEY;
+        event.key.key = *key;
+        input_queue_push(&state->input_queue, &event);
     }
 }
 
 internal void
 wl_keyboard_leave(void *data, wl_keyboard *wl_keyboard, u32 serial, wl_surface *wl_surface)
 {
-    printf("keyboard leave\n");
+    client_state *state = (client_state*)data;
+    key_repeat_stop(&state->key_repeat);
+
+    input_event event = {};
+    event.type = INPUT_EVENT_KEYBOARD_LEAVE;
+    input_queue_push(&state->input_queue, &event);
 }
 
 internal void
 wl_keyboard_modifiers(void *data, wl_keyboard *wl_keyboard, u32 serial, u32 mods_depressed, u32 mods_latched, u32 mods_locked, u32 group)
 {
     client_state *state = (client_state*)data;
-    xkb_state_update_mask(state->xkb_state, mods_depressed, mods_latched, mods_locked, 0, 0, group);
+    input_event event = {};
+    event.type = INPUT_EVENT_MODIFIERS;
+    event.modifiers.depressed = mods_depressed;
+    event.modifiers.latched = mods_latched;
+    event.modifiers.locked = mods_locked;
+    event.modifiers.group = group;
+    input_queue_push(&state->input_queue, &event);
 }
 
 internal void
 wl_keyboard_repeat_info(void *data, wl_keyboard *wl_keyboard, s32 rate, s32 delay)
 {
-    // empty
+    client_state *state = (client_state*)data;
+    key_repeat_set_info(&state->key_repeat, rate, delay);
 }
 
 internal void
 wl_keyboard_key(void *data, wl_keyboard *wl_keyboard, u32 serial, u32 time, u32 key, u32 key_state)
 {
     client_state *state = (client_state*)data;
+    input_event event = {};
+    event.type = INPUT_EVENT_KEY;
+    event.key.time = time;
+    event.key.key = key;
+    event.key.state = key_state;
+    input_queue_push(&state->input_queue, &event);
+
+    if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED)
+    {
+        key_repeat_press(&state->key_repeat, key, time);
+    }
+    else
+    {
+        key_repeat_release(&state->key_repeat, key);
+    }
+}
 
-    char buf[128];
-    u32 keycode = key + 8;
-
-    xkb_keysym_t sym = xkb_state_key_get_one_sym(state->xkb_state, keycode);
-    xkb_keysym_get_name(sym, buf, sizeof(buf));
-
-    u8 *action = key_state == WL_KEYBOARD_KEY_STATE_PRESSED ? (u8*)"press" : (u8*)"release";
-    printf("key %s: sym: %-12s (%d)", action, buf, sym);
-
-    xkb_state_key_get_utf8(state->xkb_state, keycode, buf, sizeof(buf));
-    printf("utf8: '%s'\n", buf);
+internal void
+keyboard_repeat(void *data, u32 key, u32 time)
+{
+    client_state *state = (client_state*)data;
+    input_event event = {};
+    event.type = INPUT_EVENT_KEY_REPEAT;
+    event.key.time = time;
+    event.key.key = key;
+    event.key.state = WL_KEYBOARD_KEY_STATE_PRESSED;
+    input_queue_push(&state->input_queue, &event);
 }
 
 global_variable wl_keyboard_listener wl_keyboard_listener = 
@@ -376,72 +619,11 @@ internal void
 wl_pointer_frame(void *data, wl_pointer *wl_pointer)
 {
     client_state *state = (client_state*)data;
-    pointer_event *event = &state->pointer_event;
-    printf("pointer frame @ %d :", event->time);
-
-    if (event->event_mask & POINTER_EVENT_ENTER)
-    {
-        printf("entered %f, %f", 
-            wl_fixed_to_double(event->surface_x),
-            wl_fixed_to_double(event->surface_y)
-        );
-    }
-
-    if (event->event_mask & POINTER_EVENT_LEAVE)
-    {
-        printf("leave");
-    }
-
-    if (event->event_mask & POINTER_EVENT_MOTION)
-    {
-        printf("motion %f, %f", 
-            wl_fixed_to_double(event->surface_x),
-            wl_fixed_to_double(event->surface_y)
-        );
-    }
-
-    if (event->event_mask & POINTER_EVENT_BUTTON)
-    {
-        char *state = event->state == WL_POINTER_BUTTON_STATE_RELEASED
-             ? (char*)"released" : (char*)"pressed";
-
-        printf("button %d %s", event->button, state);
-    }
-
-    u32 axis_events = 
-        POINTER_EVENT_AXIS | 
-        POINTER_EVENT_AXIS_STOP |
-        POINTER_EVENT_AXIS_DISCRETE;
-
-    if (event->event_mask & axis_events)
-    {
-        for (u8 i = 0; i < 2; ++i)
-        {
-            if (event->axes[i].valid)
-            {
-                printf("%s axis ", axis_name[i]);
-                if (event->event_mask & POINTER_EVENT_AXIS)
-                {
-                    printf("value %f ", wl_fixed_to_double(event->axes[i].value));
-                }
-                if (event->event_mask & POINTER_EVENT_AXIS_DISCRETE)
-                {
-                    printf("discrete %f ", wl_fixed_to_double(event->axes[i].discrete));
-                }
-                if (event->event_mask & POINTER_EVENT_AXIS_SOURCE)
-                {
-                    printf("via %s ", axis_source[event->axis_source]);
-                }
-                if (event->event_mask & POINTER_EVENT_AXIS_STOP)
-                {
-                    printf("stopped");
-                }
-            }
-        }
-    }
-    printf(" END FRAME\n");
-    memset(event, 0, sizeof(*event));
-
+    input_event event = {};
+    event.type = INPUT_EVENT_POINTER_FRAME;
+    event.pointer = state->pointer_event;
+    input_queue_push(&state->input_queue, &event);
+    memset(&state->pointer_event, 0, sizeof(state->pointer_event));
 }
 
 global_variable wl_pointer_listener wl_pointer_listener = 
@@ -518,55 +700,153 @@ global_variable xdg_wm_base_listener xdg_wm_base_listener = {
 /// REGISTRY 
 
 internal void
-registry_global(void *data, wl_registry *registry, u32 name, 
-    const char *interface, u32 version)
+wl_shm_format(void *data, wl_shm *wl_shm, u32 format)
 {
     client_state *state = (client_state*)data;
-
-    if (strcmp(interface, wl_shm_interface.name) == 0) 
+    pixel_format known = pixel_format_from_wl(format);
+    if (known != PIXEL_FORMAT_COUNT)
     {
-        state->wl_shm = (wl_shm*)wl_registry_bind(
-            registry,
-            name,
-            &wl_shm_interface,
-            1
-        );
-    } 
-    else if (strcmp(interface, wl_compositor_interface.name) == 0) 
-    {
-        state->wl_compositor = (wl_compositor*)wl_registry_bind( 
-            registry,
-            name,
-            &wl_compositor_interface,
-            4
-        );
-    } 
-    else if (strcmp(interface, xdg_wm_base_interface.name) == 0) 
-    {
-        state->xdg_wm_base = (xdg_wm_base*)wl_registry_bind(
-            registry,
-            name,
-            &xdg_wm_base_interface,
-            1
-        );
-        xdg_wm_base_add_listener(
-            state->xdg_wm_base, 
-            &xdg_wm_base_listener,
-            state
-        );
+        state->shm_formats |= 1u << known;
     }
-    else if (strcmp(interface, wl_seat_interface.name) == 0)
+}
+
+global_variable wl_shm_listener wl_shm_listener =
+{
+    .format = wl_shm_format,
+};
+
+internal void
+bind_wl_shm(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->wl_shm = (wl_shm*)wl_registry_bind(registry, name, &wl_shm_interface, version);
+    wl_shm_add_listener(state->wl_shm, &wl_shm_listener, state);
+}
+
+internal void
+zwp_linux_dmabuf_v1_format(void *data, zwp_linux_dmabuf_v1 *linux_dmabuf, u32 format)
+{
+    // empty, version 3 sends the modifier event for every format as well
+}
+
+internal void
+zwp_linux_dmabuf_v1_modifier(void *data, zwp_linux_dmabuf_v1 *linux_dmabuf, u32 format,
+    u32 modifier_hi, u32 modifier_lo)
+{
+    client_state *state = (client_state*)data;
+    u64 modifier = (u64)modifier_hi << 32 | modifier_lo;
+    pixel_format known = pixel_format_from_drm(format);
+    if (known != PIXEL_FORMAT_COUNT && modifier == DRM_FORMAT_MOD_LINEAR)
     {
-        state->wl_seat = (wl_seat*)wl_registry_bind(
-            registry,
-            name, 
-            &wl_seat_interface,
-            7
-        );
-        wl_seat_add_listener(state->wl_seat, &wl_seat_listener, state);
+        state->dmabuf_formats |= 1u << known;
     }
 }
 
+global_variable zwp_linux_dmabuf_v1_listener zwp_linux_dmabuf_v1_listener =
+{
+    .format = zwp_linux_dmabuf_v1_format,
+    .modifier = zwp_linux_dmabuf_v1_modifier,
+};
+
+internal void
+bind_zwp_linux_dmabuf_v1(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->linux_dmabuf = (zwp_linux_dmabuf_v1*)wl_registry_bind(
+        registry,
+        name,
+        &zwp_linux_dmabuf_v1_interface,
+        version
+    );
+    zwp_linux_dmabuf_v1_add_listener(state->linux_dmabuf, &zwp_linux_dmabuf_v1_listener, state);
+}
+
+internal void
+bind_wl_compositor(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->wl_compositor = (wl_compositor*)wl_registry_bind(
+        registry,
+        name,
+        &wl_compositor_interface,
+        version
+    );
+}
+
+internal void
+bind_xdg_wm_base(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->xdg_wm_base = (xdg_wm_base*)wl_registry_bind(
+        registry,
+        name,
+        &xdg_wm_base_interface,
+        version
+    );
+    xdg_wm_base_add_listener(
+        state->xdg_wm_base, 
+        &xdg_wm_base_listener,
+        state
+    );
+}
+
+internal void
+bind_wl_seat(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->wl_seat = (wl_seat*)wl_registry_bind(registry, name, &wl_seat_interface, version);
+    wl_seat_add_listener(state->wl_seat, &wl_seat_listener, state);
+}
+
+internal void
+bind_wp_presentation(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->wp_presentation = (wp_presentation*)wl_registry_bind(
+        registry,
+        name,
+        &wp_presentation_interface,
+        version
+    );
+    presentation_listen(state->wp_presentation, &state->presentation_clock);
+}
+
+internal void
+bind_wp_viewporter(void *data, wl_registry *registry, u32 name, u32 version)
+{
+    client_state *state = (client_state*)data;
+    state->wp_viewporter = (wp_viewporter*)wl_registry_bind(
+        registry,
+        name,
+        &wp_viewporter_interface,
+        version
+    );
+}
+
+/* Minimum versions: wl_surface.damage_buffer is from wl_compositor 4,
+ * pointer events are only handed on at wl_pointer.frame from wl_seat 5,
+ * and zwp_linux_dmabuf_v1 3 is the first to announce modifiers and the
+ * last to do it without a feedback object. */
+global_variable constexpr global_binding client_global_bindings[] =
+{
+    { "wl_shm", &wl_shm_interface, 1, 1, bind_wl_shm },
+    { "wl_compositor", &wl_compositor_interface, 4, 4, bind_wl_compositor },
+    { "xdg_wm_base", &xdg_wm_base_interface, 1, 1, bind_xdg_wm_base },
+    { "wl_seat", &wl_seat_interface, 5, 7, bind_wl_seat },
+    { "wp_presentation", &wp_presentation_interface, 1, 1, bind_wp_presentation },
+    { "wp_viewporter", &wp_viewporter_interface, 1, 1, bind_wp_viewporter },
+    { "zwp_linux_dmabuf_v1", &zwp_linux_dmabuf_v1_interface, 3, 3, bind_zwp_linux_dmabuf_v1 },
+};
+
+global_variable constexpr auto client_globals = global_table_build(client_global_bindings);
+
+internal void
+registry_global(void *data, wl_registry *registry, u32 name, 
+    const char *interface, u32 version)
+{
+    global_table_dispatch(&client_globals, data, registry, name, interface, version);
+}
+
 global_variable wl_registry_listener wl_registry_listener = {
     .global = registry_global,
     //TODO: implement release
@@ -591,8 +871,8 @@ xdg_toplevel_configure(void *data, xdg_toplevel *xdg_topleve, s32 width, s32 hei
     {
         return;
     }
-    state->width = width;
-    state->height = height;
+    state->pending_width = width;
+    state->pending_height = height;
 }
 
 global_variable xdg_toplevel_listener xdg_toplevel_listener = 
@@ -602,19 +882,215 @@ global_variable xdg_toplevel_listener xdg_toplevel_listener =
 };
 
 int
-main()
+main(int argc, char **argv)
 {
     client_state state = { };
     state.width = 640;
     state.height = 480;
+    state.content_offset = -1;
+
+    u32 buffer_count = BUFFER_POOL_MIN_BUFFERS;
+    b8 huge_pages = false;
+    u32 thread_count = 0;
+    b8 use_frame_cache = false;
+    u32 frame_cache_mb = FRAME_CACHE_DEFAULT_CAP_MB;
+    u32 offscreen_frames = 0;
+    u32 offscreen_rate = 0;
+    b8 dynamic_scale = false;
+    b8 use_dmabuf = false;
+    /* PIXEL_FORMAT_COUNT picks the cheapest one that carries the content */
+    pixel_format format = PIXEL_FORMAT_COUNT;
+    const char *log_path = NULL;
+    const char *keymap_cache_dir = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--buffers") == 0 && i + 1 < argc)
+        {
+            buffer_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hugepages") == 0)
+        {
+            huge_pages = true;
+        }
+        else if (strcmp(argv[i], "--scroll") == 0)
+        {
+            state.render_mode = RENDER_MODE_SCROLL;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frame-cache") == 0)
+        {
+            use_frame_cache = true;
+        }
+        else if (strcmp(argv[i], "--frame-cache-mb") == 0 && i + 1 < argc)
+        {
+            use_frame_cache = true;
+            frame_cache_mb = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--render-stats") == 0)
+        {
+            state.print_render_stats = true;
+        }
+        else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc)
+        {
+            log_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--keymap-cache") == 0 && i + 1 < argc)
+        {
+            keymap_cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--offscreen") == 0 && i + 1 < argc)
+        {
+            offscreen_frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+        {
+            offscreen_rate = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dynamic-scale") == 0)
+        {
+            dynamic_scale = true;
+        }
+        else if (strcmp(argv[i], "--dmabuf") == 0)
+        {
+            use_dmabuf = true;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc &&
+            (strcmp(argv[i + 1], "auto") == 0 ||
+                pixel_format_from_name(argv[i + 1]) != PIXEL_FORMAT_COUNT))
+        {
+            format = pixel_format_from_name(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc &&
+            sscanf(argv[i + 1], "%ux%u", &state.width, &state.height) == 2)
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--buffers 2-4] [--hugepages] [--scroll] "
+                "[--threads n] [--frame-cache] [--frame-cache-mb n] [--render-stats] "
+                "[--log file] [--keymap-cache dir] [--size WxH] "
+                "[--format auto|xrgb8888|argb8888|rgb565] [--dynamic-scale] [--dmabuf] "
+                "[--offscreen frames [--rate hz]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* No compositor involved: draw `offscreen_frames` frames into memory
+     * at `offscreen_rate`, 0 for as fast as possible, and exit */
+    if (offscreen_frames)
+    {
+        pattern_fill_init();
+            TRACE_FRAME_INIT();
+        thread_pool_init(&state.thread_pool, thread_count);
+        if (format == PIXEL_FORMAT_COUNT)
+        {
+            format = pixel_format_choose(~0u, CHECKER_ALPHA, CHECKER_CHANNEL_BITS);
+        }
+        state.backend = offscreen_backend_init(&state.offscreen_backend,
+            &state.render_stats, format, huge_pages);
+        render_scale_init(&state.render_scale, dynamic_scale);
+        /* One checker pixel per frame, so that every frame is drawn */
+        offscreen_backend_run(&state.offscreen_backend, offscreen_frames, offscreen_rate,
+            1000 / 24 + 1, client_frame, &state);
+
+        TRACE_FRAME_DUMP();
+        render_stats_print(&state.render_stats);
+        render_scale_print_stats(&state.render_scale);
+        frame_time_print_stats(&state.frame_time);
+        state.backend.print_stats(state.backend.data);
+        thread_pool_print_stats(&state.thread_pool);
+        state.backend.destroy(state.backend.data);
+        thread_pool_destroy(&state.thread_pool);
+        return 0;
+    }
+
     state.wl_display = wl_display_connect(NULL);
     state.wl_registry = wl_display_get_registry(state.wl_display);
     state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    keymap_cache_init(&state.keymap_cache, state.xkb_context, keymap_cache_dir);
+    pattern_fill_init();
+    TRACE_FRAME_INIT();
+    thread_pool_init(&state.thread_pool, thread_count);
+    if (!event_log_start(log_path))
+    {
+        fprintf(stderr, "Unable to start the event log.\n");
+        return 1;
+    }
+    if (!input_queue_init(&state.input_queue, input_process_batch, &state))
+    {
+        fprintf(stderr, "Unable to start the input thread.\n");
+        return 1;
+    }
+    /* Before the first roundtrip, keyboard events need the repeat timer */
+    if (!event_loop_init(&state.event_loop, state.wl_display))
+    {
+        fprintf(stderr, "Unable to create the event loop.\n");
+        return 1;
+    }
+    if (!key_repeat_init(&state.key_repeat, &state.event_loop, keyboard_repeat, &state))
+    {
+        fprintf(stderr, "Unable to create the key repeat timer.\n");
+        return 1;
+    }
 
+    assert(global_table_check(&client_globals));
     wl_registry_add_listener(state.wl_registry, &wl_registry_listener, &state);
     wl_display_roundtrip(state.wl_display);
+    /* For the events the new bindings send right away, e.g. wl_shm.format
+     * and wp_presentation.clock_id */
+    wl_display_roundtrip(state.wl_display);
+    if (!state.wl_compositor || !state.wl_shm || !state.xdg_wm_base)
+    {
+        fprintf(stderr, "The compositor lacks wl_compositor 4, wl_shm or xdg_wm_base.\n");
+        return 1;
+    }
+
+    if (format == PIXEL_FORMAT_COUNT)
+    {
+        /* Preferring what both paths take keeps the dmabuf path usable */
+        u32 available = state.shm_formats;
+        if (use_dmabuf && (available & state.dmabuf_formats))
+        {
+            available &= state.dmabuf_formats;
+        }
+        format = pixel_format_choose(available, CHECKER_ALPHA, CHECKER_CHANNEL_BITS);
+    }
+    else if (format != PIXEL_FORMAT_XRGB8888 && format != PIXEL_FORMAT_ARGB8888 &&
+        !(state.shm_formats & (1u << format)))
+    {
+        fprintf(stderr, "The compositor does not support %s.\n", pixel_formats[format].name);
+        return 1;
+    }
+
+    /* Falls back to wl_shm when the compositor cannot take the buffers */
+    zwp_linux_dmabuf_v1 *linux_dmabuf = NULL;
+    if (use_dmabuf && !state.linux_dmabuf)
+    {
+        fprintf(stderr, "dmabuf: zwp_linux_dmabuf_v1 version 3 not supported, using wl_shm\n");
+    }
+    else if (use_dmabuf && !(state.dmabuf_formats & (1u << format)))
+    {
+        fprintf(stderr, "dmabuf: no linear %s import, using wl_shm\n", pixel_formats[format].name);
+    }
+    else if (use_dmabuf)
+    {
+        linux_dmabuf = state.linux_dmabuf;
+    }
 
     state.wl_surface = wl_compositor_create_surface(state.wl_compositor);
+    state.backend = surface_backend_init(&state.surface_backend,
+        state.wl_display, state.wl_surface, state.wl_shm, linux_dmabuf, state.wp_presentation,
+        state.presentation_clock, state.wp_viewporter, format, buffer_count, huge_pages,
+        use_frame_cache, frame_cache_mb);
+    if (dynamic_scale && !state.backend.set_destination)
+    {
+        fprintf(stderr, "render scale: wp_viewporter not supported, rendering at full size\n");
+    }
+    render_scale_init(&state.render_scale, dynamic_scale && state.backend.set_destination);
     state.xdg_surface = xdg_wm_base_get_xdg_surface(
         state.xdg_wm_base,
         state.wl_surface
@@ -627,9 +1103,43 @@ main()
 
     wl_callback *cb = wl_surface_frame(state.wl_surface);
     wl_callback_add_listener(cb, &wl_surface_frame_listener, &state);
-    while (wl_display_dispatch(state.wl_display) && !state.closed) 
+    while (!state.closed && event_loop_dispatch(&state.event_loop) != -1)
     {
-
+        apply_configure(&state);
+        TRACE_FRAME_POLL();
+    }
+    /* libwayland has already logged the details of a protocol error */
+    int display_error = wl_display_get_error(state.wl_display);
+    if (display_error)
+    {
+        fprintf(stderr, "Lost the compositor connection: %s\n", strerror(display_error));
     }
+
+    input_queue_destroy(&state.input_queue);
+    event_log_stop();
+    xkb_state_unref(state.xkb_state);
+    xkb_keymap_unref(state.xkb_keymap);
+    keymap_cache_destroy(&state.keymap_cache);
+    xkb_context_unref(state.xkb_context);
+
+    TRACE_FRAME_DUMP();
+    render_stats_print(&state.render_stats);
+    render_scale_print_stats(&state.render_scale);
+    frame_time_print_stats(&state.frame_time);
+    fprintf(stderr, "configure: %llu received, %llu applied\n",
+        (unsigned long long)state.configures_received,
+        (unsigned long long)state.configures_applied
+    );
+    state.backend.print_stats(state.backend.data);
+    thread_pool_print_stats(&state.thread_pool);
+    event_loop_print_stats(&state.event_loop);
+    input_queue_print_stats(&state.input_queue);
+    key_repeat_print_stats(&state.key_repeat);
+    event_log_print_stats();
+    keymap_cache_print_stats(&state.keymap_cache);
+    key_tables_print_stats(&state.key_tables);
+    state.backend.destroy(state.backend.data);
+    thread_pool_destroy(&state.thread_pool);
+    event_loop_destroy(&state.event_loop);
     return 0;
 }
@@ -0,0 +1,98 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-client.h>
+#include <stdio.h>
+#include <errno.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "include/types.h"
+
+#include "src/event_log_record.cpp"
+
+/* Renders a raw event log written by `client --log file` as text, one
+ * line per record, optionally keeping only some record types. */
+
+global_variable const char *event_log_type_names[EVENT_LOG_TYPE_COUNT] =
+{
+    "pointer", "enter", "enter-key", "leave", "key", "repeat",
+};
+
+int
+main(int argc, char **argv)
+{
+    const char *path = NULL;
+    u32 type_mask = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        b8 matched = false;
+        if (strcmp(argv[i], "--type") == 0 && i + 1 < argc)
+        {
+            ++i;
+            for (u32 type = 0; type < EVENT_LOG_TYPE_COUNT; ++type)
+            {
+                if (strcmp(argv[i], event_log_type_names[type]) == 0)
+                {
+                    type_mask |= 1 << type;
+                    matched = true;
+                }
+            }
+        }
+        else if (!path && argv[i][0] != '-')
+        {
+            path = argv[i];
+            matched = true;
+        }
+
+        if (!matched)
+        {
+            fprintf(stderr, "usage: %s [--type pointer|enter|enter-key|leave|key|repeat]... file\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!path)
+    {
+        fprintf(stderr, "usage: %s [--type pointer|enter|enter-key|leave|key|repeat]... file\n", argv[0]);
+        return 1;
+    }
+    if (!type_mask)
+    {
+        type_mask = ~0u;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    event_log_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, event_log_magic, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not an event log\n", path);
+        return 1;
+    }
+    if (header.version != EVENT_LOG_VERSION || header.record_size != sizeof(event_log_record))
+    {
+        fprintf(stderr, "%s: unsupported log version %u with %u byte records\n",
+            path, header.version, header.record_size);
+        return 1;
+    }
+
+    u64 count = 0;
+    event_log_record record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (record.type < 32 && !(type_mask & (1u << record.type)))
+        {
+            continue;
+        }
+        event_log_format(stdout, &record);
+        ++count;
+    }
+    fclose(file);
+    fprintf(stderr, "%llu records\n", (unsigned long long)count);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Runs the same workload against two builds and reports the client's frame
+# times side by side, with the change of the second against the first.
+#
+#     scripts/compare_profiles.sh out/release out/pgo [runs] [frames]
+
+set -e
+
+base=${1:?usage: $0 base-bindir other-bindir [runs] [frames]}
+other=${2:?usage: $0 base-bindir other-bindir [runs] [frames]}
+runs=${3:-3}
+frames=${4:-600}
+dir=$(dirname "$0")
+
+# Prints "mode mean median p99" per mode, each the median over the runs
+collect() {
+    run=0
+    while [ $run -lt "$runs" ]; do
+        "$dir/workload.sh" "$1" "$frames"
+        run=$((run + 1))
+    done | awk '
+        /^mode:/ { mode = $2 }
+        /^frame time:/ {
+            n = ++count[mode]
+            mean[mode, n] = $6; median[mode, n] = $9; p99[mode, n] = $12
+            if (!(mode in order)) { order[mode] = ++modes; names[modes] = mode }
+        }
+        function mid(values, mode, n,    i, j, t, a) {
+            for (i = 1; i <= n; ++i) a[i] = values[mode, i]
+            for (i = 2; i <= n; ++i)
+                for (j = i; j > 1 && a[j - 1] > a[j]; --j) { t = a[j]; a[j] = a[j - 1]; a[j - 1] = t }
+            return a[int((n + 1) / 2)]
+        }
+        END {
+            for (m = 1; m <= modes; ++m) {
+                mode = names[m]
+                print mode, mid(mean, mode, count[mode]), mid(median, mode, count[mode]), mid(p99, mode, count[mode])
+            }
+        }'
+}
+
+collect "$base" > "${TMPDIR:-/tmp}/compare-base.$$"
+collect "$other" > "${TMPDIR:-/tmp}/compare-other.$$"
+
+echo "frame time in us, median of $runs runs of $frames frames: $base -> $other"
+awk '
+    function delta(a, b) { return a > 0 ? sprintf("%+.1f%%", (b - a) / a * 100) : "n/a" }
+    BEGIN { printf "%-8s %22s %22s %22s\n", "mode", "mean", "median", "p99" }
+    NR == FNR { mean[$1] = $2; median[$1] = $3; p99[$1] = $4; next }
+    $1 in mean {
+        printf "%-8s %8.1f %6.1f %6s %8.1f %6.1f %6s %8.1f %6.1f %6s\n", $1,
+            mean[$1], $2, delta(mean[$1], $2),
+            median[$1], $3, delta(median[$1], $3),
+            p99[$1], $4, delta(p99[$1], $4)
+    }' "${TMPDIR:-/tmp}/compare-base.$$" "${TMPDIR:-/tmp}/compare-other.$$"
+rm -f "${TMPDIR:-/tmp}/compare-base.$$" "${TMPDIR:-/tmp}/compare-other.$$"
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Runs the headless server and the client from BINDIR through a fixed set
+# of rendering modes and prints the client's exit statistics for each.
+# Used to train the pgo build and by compare_profiles.sh.
+#
+#     scripts/workload.sh out/release [frames]
+
+set -e
+
+bindir=${1:?usage: $0 bindir [frames]}
+frames=${2:-600}
+
+if [ -z "$XDG_RUNTIME_DIR" ]; then
+    XDG_RUNTIME_DIR=$(mktemp -d)
+    export XDG_RUNTIME_DIR
+    trap 'rm -rf "$XDG_RUNTIME_DIR"' EXIT
+fi
+
+run_mode() {
+    mode=$1
+    shift
+    socket="workload-$$-$mode"
+    # A fast refresh keeps the client busy instead of waiting on vblank
+    "$bindir/server" --socket "$socket" --frames "$frames" --refresh-hz 240 \
+        --size 1920x1080 2> /dev/null &
+    server=$!
+
+    tries=0
+    while [ ! -S "$XDG_RUNTIME_DIR/$socket" ]; do
+        tries=$((tries + 1))
+        if [ $tries -gt 100 ]; then
+            echo "workload: server did not start" >&2
+            kill $server 2> /dev/null
+            exit 1
+        fi
+        sleep 0.05
+    done
+
+    echo "mode: $mode"
+    WAYLAND_DISPLAY="$socket" "$bindir/client" "$@" 2>&1 > /dev/null || true
+    wait $server || true
+}
+
+run_mode full
+run_mode scroll --scroll
+run_mode threads --threads 4
+run_mode cache --frame-cache
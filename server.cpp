@@ -1,22 +1,1410 @@
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 #include <wayland-server.h>
 
-int 
-main()
+#include "include/xdg-shell-server-protocol.h"
+#include "include/presentation-time-server-protocol.h"
+#include "include/viewporter-server-protocol.h"
+#include "include/linux-dmabuf-unstable-v1-server-protocol.h"
+#include "include/types.h"
+
+#include "src/xdg-shell-protocol.c"
+#include "src/presentation-time-protocol.c"
+#include "src/viewporter-protocol.c"
+#include "src/linux-dmabuf-unstable-v1-protocol.c"
+#include "src/clock.cpp"
+
+/* Headless compositor: implements just enough of the core protocol,
+ * xdg_shell, wp_presentation, wp_viewporter and zwp_linux_dmabuf_v1 for a
+ * client to run end to end. Nothing is displayed. Committed shm buffers
+ * are copied once per refresh cycle, which stands in for the texture
+ * upload a real compositor would do, while dmabufs are imported once when
+ * their wl_buffer is created and used in place like a GPU would sample
+ * them. A timer plays the part of vblank. */
+
+#define HEADLESS_DEFAULT_REFRESH_HZ 60
+/* Later versions add events (configure_bounds, wm_capabilities) that are
+ * not sent here */
+#define HEADLESS_XDG_WM_BASE_VERSION 3
+
+struct server_stats
+{
+    u64 refreshes;
+    u64 missed_refreshes;
+    u64 commits;
+    u64 presented;
+    u64 discarded;
+    /* Presented buffers whose size differs from their wp_viewport
+     * destination, which a real compositor would scale while drawing */
+    u64 scaled;
+    u64 bytes_copied;
+    /* dmabuf frames presented without a copy and what they would have
+     * cost in it */
+    u64 imported;
+    u64 bytes_imported;
+    u64 import_failures;
+};
+
+struct server_state
+{
+    wl_display *wl_display;
+    wl_event_loop *wl_event_loop;
+    wl_event_source *refresh_timer;
+
+    u64 refresh_ns;
+    u64 next_refresh_ns;
+    u64 msc;
+    u64 max_refreshes;
+    s32 configure_width;
+    s32 configure_height;
+
+    wl_list surfaces;
+    server_stats stats;
+    timespec start;
+};
+
+struct headless_surface
+{
+    server_state *server;
+    wl_resource *resource;
+    wl_list link;
+
+    /* Double-buffered state, applied on commit */
+    wl_resource *pending_buffer;
+    wl_listener pending_buffer_destroy;
+    b8 pending_attached;
+    wl_list pending_frames;
+    wl_list pending_feedbacks;
+
+    /* Committed and waiting for the next refresh */
+    wl_resource *buffer;
+    wl_listener buffer_destroy;
+    wl_list frames;
+    wl_list feedbacks;
+
+    /* -1 for unset, like the protocol. Destination only; the source
+     * rectangle is checked and ignored. */
+    wl_resource *viewport;
+    s32 pending_destination_width;
+    s32 pending_destination_height;
+    s32 destination_width;
+    s32 destination_height;
+
+    wl_resource *xdg_surface;
+    wl_resource *xdg_toplevel;
+    b8 configure_sent;
+    b8 configured;
+
+    /* The copy of the last presented buffer */
+    u8 *pixels;
+    size_t pixels_size;
+};
+
+internal void
+remove_resource_link(wl_resource *resource)
+{
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+internal void
+destroy_resource(wl_client *client, wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+/// SURFACE
+
+internal void
+surface_set_pending_buffer(headless_surface *surface, wl_resource *buffer)
+{
+    if (surface->pending_buffer)
+    {
+        wl_list_remove(&surface->pending_buffer_destroy.link);
+    }
+    surface->pending_buffer = buffer;
+    if (buffer)
+    {
+        wl_resource_add_destroy_listener(buffer, &surface->pending_buffer_destroy);
+    }
+}
+
+internal void
+surface_set_buffer(headless_surface *surface, wl_resource *buffer)
+{
+    if (surface->buffer)
+    {
+        wl_list_remove(&surface->buffer_destroy.link);
+    }
+    surface->buffer = buffer;
+    if (buffer)
+    {
+        wl_resource_add_destroy_listener(buffer, &surface->buffer_destroy);
+    }
+}
+
+internal void
+surface_pending_buffer_destroyed(wl_listener *listener, void *data)
+{
+    headless_surface *surface = wl_container_of(listener, surface, pending_buffer_destroy);
+    wl_list_remove(&surface->pending_buffer_destroy.link);
+    surface->pending_buffer = NULL;
+}
+
+internal void
+surface_buffer_destroyed(wl_listener *listener, void *data)
+{
+    headless_surface *surface = wl_container_of(listener, surface, buffer_destroy);
+    wl_list_remove(&surface->buffer_destroy.link);
+    surface->buffer = NULL;
+}
+
+internal void
+surface_discard_feedbacks(headless_surface *surface, wl_list *feedbacks)
+{
+    wl_resource *feedback, *tmp;
+    wl_resource_for_each_safe(feedback, tmp, feedbacks)
+    {
+        wp_presentation_feedback_send_discarded(feedback);
+        wl_resource_destroy(feedback);
+        ++surface->server->stats.discarded;
+    }
+}
+
+internal void
+surface_attach(wl_client *client, wl_resource *resource, wl_resource *buffer,
+    s32 x, s32 y)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    surface_set_pending_buffer(surface, buffer);
+    surface->pending_attached = true;
+}
+
+internal void
+surface_damage(wl_client *client, wl_resource *resource,
+    s32 x, s32 y, s32 width, s32 height)
+{
+    // empty, every refresh copies the whole buffer
+}
+
+internal void
+surface_frame(wl_client *client, wl_resource *resource, u32 id)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    wl_resource *callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+    if (!callback)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(callback, NULL, NULL, remove_resource_link);
+    wl_list_insert(surface->pending_frames.prev, wl_resource_get_link(callback));
+}
+
+internal void
+surface_set_region(wl_client *client, wl_resource *resource, wl_resource *region)
+{
+    // empty
+}
+
+internal void
+surface_set_buffer_transform(wl_client *client, wl_resource *resource, s32 transform)
+{
+    // empty
+}
+
+internal void
+surface_set_buffer_scale(wl_client *client, wl_resource *resource, s32 scale)
+{
+    // empty
+}
+
+internal void
+surface_send_configure(headless_surface *surface)
+{
+    server_state *server = surface->server;
+    wl_array states;
+    wl_array_init(&states);
+    xdg_toplevel_send_configure(surface->xdg_toplevel,
+        server->configure_width, server->configure_height, &states);
+    wl_array_release(&states);
+    xdg_surface_send_configure(surface->xdg_surface, wl_display_next_serial(server->wl_display));
+    surface->configure_sent = true;
+}
+
+internal void
+surface_commit(wl_client *client, wl_resource *resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    server_state *server = surface->server;
+    ++server->stats.commits;
+
+    if (surface->pending_attached)
+    {
+        if (surface->pending_buffer && surface->xdg_surface && !surface->configured)
+        {
+            wl_resource_post_error(surface->xdg_surface, XDG_SURFACE_ERROR_UNCONFIGURED_BUFFER,
+                "buffer committed before the first configure was acked");
+            return;
+        }
+
+        /* A buffer that never reached a refresh is superseded */
+        if (surface->buffer && surface->buffer != surface->pending_buffer)
+        {
+            wl_buffer_send_release(surface->buffer);
+        }
+        surface_discard_feedbacks(surface, &surface->feedbacks);
+        surface_set_buffer(surface, surface->pending_buffer);
+        surface_set_pending_buffer(surface, NULL);
+        surface->pending_attached = false;
+    }
+
+    surface->destination_width = surface->pending_destination_width;
+    surface->destination_height = surface->pending_destination_height;
+
+    wl_list_insert_list(surface->frames.prev, &surface->pending_frames);
+    wl_list_init(&surface->pending_frames);
+    wl_list_insert_list(surface->feedbacks.prev, &surface->pending_feedbacks);
+    wl_list_init(&surface->pending_feedbacks);
+
+    if (surface->xdg_toplevel && !surface->configure_sent)
+    {
+        surface_send_configure(surface);
+    }
+}
+
+global_variable struct wl_surface_interface surface_implementation =
+{
+    .destroy = destroy_resource,
+    .attach = surface_attach,
+    .damage = surface_damage,
+    .frame = surface_frame,
+    .set_opaque_region = surface_set_region,
+    .set_input_region = surface_set_region,
+    .commit = surface_commit,
+    .set_buffer_transform = surface_set_buffer_transform,
+    .set_buffer_scale = surface_set_buffer_scale,
+    .damage_buffer = surface_damage,
+};
+
+internal void
+surface_resource_destroyed(wl_resource *resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+
+    surface_discard_feedbacks(surface, &surface->pending_feedbacks);
+    surface_discard_feedbacks(surface, &surface->feedbacks);
+
+    wl_resource *callback, *tmp;
+    wl_resource_for_each_safe(callback, tmp, &surface->pending_frames)
+    {
+        wl_resource_destroy(callback);
+    }
+    wl_resource_for_each_safe(callback, tmp, &surface->frames)
+    {
+        wl_resource_destroy(callback);
+    }
+
+    surface_set_pending_buffer(surface, NULL);
+    surface_set_buffer(surface, NULL);
+    if (surface->xdg_surface)
+    {
+        wl_resource_set_user_data(surface->xdg_surface, NULL);
+    }
+    if (surface->xdg_toplevel)
+    {
+        wl_resource_set_user_data(surface->xdg_toplevel, NULL);
+    }
+    if (surface->viewport)
+    {
+        wl_resource_set_user_data(surface->viewport, NULL);
+    }
+
+    wl_list_remove(&surface->link);
+    free(surface->pixels);
+    free(surface);
+}
+
+/// REGION
+
+internal void
+region_edit(wl_client *client, wl_resource *resource,
+    s32 x, s32 y, s32 width, s32 height)
+{
+    // empty, regions have no effect on a headless output
+}
+
+global_variable struct wl_region_interface region_implementation =
+{
+    .destroy = destroy_resource,
+    .add = region_edit,
+    .subtract = region_edit,
+};
+
+/// COMPOSITOR
+
+internal void
+compositor_create_surface(wl_client *client, wl_resource *resource, u32 id)
+{
+    server_state *server = (server_state*)wl_resource_get_user_data(resource);
+
+    headless_surface *surface = (headless_surface*)calloc(1, sizeof(headless_surface));
+    if (!surface)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    surface->resource = wl_resource_create(client, &wl_surface_interface,
+        wl_resource_get_version(resource), id);
+    if (!surface->resource)
+    {
+        free(surface);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    surface->server = server;
+    surface->pending_buffer_destroy.notify = surface_pending_buffer_destroyed;
+    surface->buffer_destroy.notify = surface_buffer_destroyed;
+    surface->pending_destination_width = -1;
+    surface->pending_destination_height = -1;
+    surface->destination_width = -1;
+    surface->destination_height = -1;
+    wl_list_init(&surface->pending_frames);
+    wl_list_init(&surface->pending_feedbacks);
+    wl_list_init(&surface->frames);
+    wl_list_init(&surface->feedbacks);
+    wl_list_insert(server->surfaces.prev, &surface->link);
+
+    wl_resource_set_implementation(surface->resource, &surface_implementation,
+        surface, surface_resource_destroyed);
+}
+
+internal void
+compositor_create_region(wl_client *client, wl_resource *resource, u32 id)
+{
+    wl_resource *region = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!region)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(region, &region_implementation, NULL, NULL);
+}
+
+global_variable struct wl_compositor_interface compositor_implementation =
+{
+    .create_surface = compositor_create_surface,
+    .create_region = compositor_create_region,
+};
+
+internal void
+compositor_bind(wl_client *client, void *data, u32 version, u32 id)
+{
+    wl_resource *resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+    if (!resource)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &compositor_implementation, data, NULL);
+}
+
+/// XDG_TOPLEVEL
+
+internal void
+xdg_toplevel_set_parent(wl_client *client, wl_resource *resource, wl_resource *parent)
+{
+    // empty
+}
+
+internal void
+xdg_toplevel_set_string(wl_client *client, wl_resource *resource, const char *value)
+{
+    // empty
+}
+
+internal void
+xdg_toplevel_show_window_menu(wl_client *client, wl_resource *resource,
+    wl_resource *seat, u32 serial, s32 x, s32 y)
+{
+    // empty
+}
+
+internal void
+xdg_toplevel_move(wl_client *client, wl_resource *resource, wl_resource *seat, u32 serial)
+{
+    // empty
+}
+
+internal void
+xdg_toplevel_resize(wl_client *client, wl_resource *resource,
+    wl_resource *seat, u32 serial, u32 edges)
+{
+    // empty
+}
+
+internal void
+xdg_toplevel_set_size(wl_client *client, wl_resource *resource, s32 width, s32 height)
+{
+    // empty
+}
+
+internal void
+xdg_toplevel_set_state(wl_client *client, wl_resource *resource)
+{
+    // empty, the window state never changes on a headless output
+}
+
+internal void
+xdg_toplevel_set_fullscreen(wl_client *client, wl_resource *resource, wl_resource *output)
+{
+    // empty
+}
+
+global_variable struct xdg_toplevel_interface xdg_toplevel_implementation =
+{
+    .destroy = destroy_resource,
+    .set_parent = xdg_toplevel_set_parent,
+    .set_title = xdg_toplevel_set_string,
+    .set_app_id = xdg_toplevel_set_string,
+    .show_window_menu = xdg_toplevel_show_window_menu,
+    .move = xdg_toplevel_move,
+    .resize = xdg_toplevel_resize,
+    .set_max_size = xdg_toplevel_set_size,
+    .set_min_size = xdg_toplevel_set_size,
+    .set_maximized = xdg_toplevel_set_state,
+    .unset_maximized = xdg_toplevel_set_state,
+    .set_fullscreen = xdg_toplevel_set_fullscreen,
+    .unset_fullscreen = xdg_toplevel_set_state,
+    .set_minimized = xdg_toplevel_set_state,
+};
+
+internal void
+xdg_toplevel_resource_destroyed(wl_resource *resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (surface)
+    {
+        surface->xdg_toplevel = NULL;
+    }
+}
+
+/// XDG_SURFACE
+
+internal void
+xdg_surface_get_toplevel(wl_client *client, wl_resource *resource, u32 id)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (!surface)
+    {
+        wl_client_post_implementation_error(client, "wl_surface was destroyed");
+        return;
+    }
+    if (surface->xdg_toplevel)
+    {
+        wl_resource_post_error(resource, XDG_SURFACE_ERROR_ALREADY_CONSTRUCTED,
+            "xdg_surface already has a role object");
+        return;
+    }
+
+    wl_resource *toplevel = wl_resource_create(client, &xdg_toplevel_interface,
+        wl_resource_get_version(resource), id);
+    if (!toplevel)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(toplevel, &xdg_toplevel_implementation,
+        surface, xdg_toplevel_resource_destroyed);
+    surface->xdg_toplevel = toplevel;
+}
+
+internal void
+xdg_surface_get_popup(wl_client *client, wl_resource *resource, u32 id,
+    wl_resource *parent, wl_resource *positioner)
+{
+    wl_client_post_implementation_error(client,
+        "popups are not supported by the headless compositor");
+}
+
+internal void
+xdg_surface_set_window_geometry(wl_client *client, wl_resource *resource,
+    s32 x, s32 y, s32 width, s32 height)
+{
+    // empty
+}
+
+internal void
+xdg_surface_ack_configure(wl_client *client, wl_resource *resource, u32 serial)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (surface)
+    {
+        surface->configured = true;
+    }
+}
+
+global_variable struct xdg_surface_interface xdg_surface_implementation =
+{
+    .destroy = destroy_resource,
+    .get_toplevel = xdg_surface_get_toplevel,
+    .get_popup = xdg_surface_get_popup,
+    .set_window_geometry = xdg_surface_set_window_geometry,
+    .ack_configure = xdg_surface_ack_configure,
+};
+
+internal void
+xdg_surface_resource_destroyed(wl_resource *resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (surface)
+    {
+        surface->xdg_surface = NULL;
+        surface->configure_sent = false;
+        surface->configured = false;
+    }
+}
+
+/// XDG_POSITIONER
+
+internal void
+xdg_positioner_set_rect(wl_client *client, wl_resource *resource,
+    s32 x, s32 y, s32 width, s32 height)
+{
+    // empty
+}
+
+internal void
+xdg_positioner_set_size(wl_client *client, wl_resource *resource, s32 width, s32 height)
+{
+    // empty
+}
+
+internal void
+xdg_positioner_set_value(wl_client *client, wl_resource *resource, u32 value)
+{
+    // empty
+}
+
+internal void
+xdg_positioner_set_reactive(wl_client *client, wl_resource *resource)
+{
+    // empty
+}
+
+/* Positioners are accepted and ignored, get_popup refuses to use them */
+global_variable struct xdg_positioner_interface xdg_positioner_implementation =
+{
+    .destroy = destroy_resource,
+    .set_size = xdg_positioner_set_size,
+    .set_anchor_rect = xdg_positioner_set_rect,
+    .set_anchor = xdg_positioner_set_value,
+    .set_gravity = xdg_positioner_set_value,
+    .set_constraint_adjustment = xdg_positioner_set_value,
+    .set_offset = xdg_positioner_set_size,
+    .set_reactive = xdg_positioner_set_reactive,
+    .set_parent_size = xdg_positioner_set_size,
+    .set_parent_configure = xdg_positioner_set_value,
+};
+
+/// XDG_WM_BASE
+
+internal void
+xdg_wm_base_create_positioner(wl_client *client, wl_resource *resource, u32 id)
+{
+    wl_resource *positioner = wl_resource_create(client, &xdg_positioner_interface,
+        wl_resource_get_version(resource), id);
+    if (!positioner)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(positioner, &xdg_positioner_implementation, NULL, NULL);
+}
+
+internal void
+xdg_wm_base_get_xdg_surface(wl_client *client, wl_resource *resource, u32 id,
+    wl_resource *surface_resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(surface_resource);
+    if (surface->xdg_surface)
+    {
+        wl_resource_post_error(resource, XDG_WM_BASE_ERROR_ROLE,
+            "wl_surface already has an xdg_surface");
+        return;
+    }
+    if (surface->buffer || surface->pending_buffer)
+    {
+        wl_resource_post_error(resource, XDG_WM_BASE_ERROR_INVALID_SURFACE_STATE,
+            "wl_surface already has a buffer attached");
+        return;
+    }
+
+    wl_resource *xdg_surface = wl_resource_create(client, &xdg_surface_interface,
+        wl_resource_get_version(resource), id);
+    if (!xdg_surface)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(xdg_surface, &xdg_surface_implementation,
+        surface, xdg_surface_resource_destroyed);
+    surface->xdg_surface = xdg_surface;
+}
+
+internal void
+xdg_wm_base_pong(wl_client *client, wl_resource *resource, u32 serial)
+{
+    // empty, clients are never pinged
+}
+
+global_variable struct xdg_wm_base_interface xdg_wm_base_implementation =
+{
+    .destroy = destroy_resource,
+    .create_positioner = xdg_wm_base_create_positioner,
+    .get_xdg_surface = xdg_wm_base_get_xdg_surface,
+    .pong = xdg_wm_base_pong,
+};
+
+internal void
+xdg_wm_base_bind(wl_client *client, void *data, u32 version, u32 id)
+{
+    wl_resource *resource = wl_resource_create(client, &xdg_wm_base_interface, version, id);
+    if (!resource)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &xdg_wm_base_implementation, data, NULL);
+}
+
+/// PRESENTATION
+
+internal void
+presentation_feedback(wl_client *client, wl_resource *resource,
+    wl_resource *surface_resource, u32 id)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(surface_resource);
+    wl_resource *feedback = wl_resource_create(client, &wp_presentation_feedback_interface,
+        wl_resource_get_version(resource), id);
+    if (!feedback)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(feedback, NULL, NULL, remove_resource_link);
+    wl_list_insert(surface->pending_feedbacks.prev, wl_resource_get_link(feedback));
+}
+
+global_variable struct wp_presentation_interface presentation_implementation =
+{
+    .destroy = destroy_resource,
+    .feedback = presentation_feedback,
+};
+
+internal void
+presentation_bind(wl_client *client, void *data, u32 version, u32 id)
+{
+    wl_resource *resource = wl_resource_create(client, &wp_presentation_interface, version, id);
+    if (!resource)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &presentation_implementation, data, NULL);
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+/// VIEWPORTER
+
+internal void
+viewport_set_source(wl_client *client, wl_resource *resource,
+    wl_fixed_t x, wl_fixed_t y, wl_fixed_t width, wl_fixed_t height)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (!surface)
+    {
+        wl_resource_post_error(resource, WP_VIEWPORT_ERROR_NO_SURFACE,
+            "wl_surface was destroyed");
+        return;
+    }
+    wl_fixed_t unset = wl_fixed_from_int(-1);
+    b8 is_unset = x == unset && y == unset && width == unset && height == unset;
+    if (!is_unset && (x < 0 || y < 0 || width <= 0 || height <= 0))
+    {
+        wl_resource_post_error(resource, WP_VIEWPORT_ERROR_BAD_VALUE,
+            "invalid source rectangle");
+    }
+}
+
+internal void
+viewport_set_destination(wl_client *client, wl_resource *resource, s32 width, s32 height)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (!surface)
+    {
+        wl_resource_post_error(resource, WP_VIEWPORT_ERROR_NO_SURFACE,
+            "wl_surface was destroyed");
+        return;
+    }
+    if ((width != -1 || height != -1) && (width <= 0 || height <= 0))
+    {
+        wl_resource_post_error(resource, WP_VIEWPORT_ERROR_BAD_VALUE,
+            "invalid destination size %dx%d", width, height);
+        return;
+    }
+    surface->pending_destination_width = width;
+    surface->pending_destination_height = height;
+}
+
+global_variable struct wp_viewport_interface viewport_implementation =
+{
+    .destroy = destroy_resource,
+    .set_source = viewport_set_source,
+    .set_destination = viewport_set_destination,
+};
+
+/* Removing the viewport unsets its state with the next commit */
+internal void
+viewport_resource_destroyed(wl_resource *resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(resource);
+    if (surface)
+    {
+        surface->viewport = NULL;
+        surface->pending_destination_width = -1;
+        surface->pending_destination_height = -1;
+    }
+}
+
+internal void
+viewporter_get_viewport(wl_client *client, wl_resource *resource, u32 id,
+    wl_resource *surface_resource)
+{
+    headless_surface *surface = (headless_surface*)wl_resource_get_user_data(surface_resource);
+    if (surface->viewport)
+    {
+        wl_resource_post_error(resource, WP_VIEWPORTER_ERROR_VIEWPORT_EXISTS,
+            "wl_surface already has a viewport");
+        return;
+    }
+
+    wl_resource *viewport = wl_resource_create(client, &wp_viewport_interface,
+        wl_resource_get_version(resource), id);
+    if (!viewport)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(viewport, &viewport_implementation,
+        surface, viewport_resource_destroyed);
+    surface->viewport = viewport;
+}
+
+global_variable struct wp_viewporter_interface viewporter_implementation =
+{
+    .destroy = destroy_resource,
+    .get_viewport = viewporter_get_viewport,
+};
+
+internal void
+viewporter_bind(wl_client *client, void *data, u32 version, u32 id)
+{
+    wl_resource *resource = wl_resource_create(client, &wp_viewporter_interface, version, id);
+    if (!resource)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &viewporter_implementation, data, NULL);
+}
+
+/// LINUX_DMABUF
+
+/* Linear single-plane formats that can be imported, as DRM fourcc codes */
+struct headless_dmabuf_format
+{
+    u32 drm_format;
+    u32 bytes_per_pixel;
+};
+
+global_variable const headless_dmabuf_format headless_dmabuf_formats[] =
+{
+    { 0x34325258, 4 }, /* XR24 */
+    { 0x34325241, 4 }, /* AR24 */
+    { 0x36314752, 2 }, /* RG16 */
+};
+
+/* The params object collects the one plane until create */
+struct headless_dmabuf_params
+{
+    server_state *server;
+    int fd;
+    u32 offset;
+    u32 stride;
+    u64 modifier;
+    b8 used;
+};
+
+/* An imported dmabuf wl_buffer. `data` is NULL for one whose import
+ * failed, which stays inert until the client destroys it. */
+struct headless_dmabuf
+{
+    int fd;
+    void *data;
+    size_t size;
+    s32 width;
+    s32 height;
+    u32 stride;
+};
+
+internal void
+headless_dmabuf_free(headless_dmabuf *dmabuf)
+{
+    if (dmabuf->data)
+    {
+        munmap(dmabuf->data, dmabuf->size);
+    }
+    if (dmabuf->fd >= 0)
+    {
+        close(dmabuf->fd);
+    }
+    free(dmabuf);
+}
+
+internal void
+dmabuf_buffer_resource_destroyed(wl_resource *resource)
+{
+    headless_dmabuf_free((headless_dmabuf*)wl_resource_get_user_data(resource));
+}
+
+global_variable struct wl_buffer_interface dmabuf_buffer_implementation =
+{
+    .destroy = destroy_resource,
+};
+
+/* NULL for buffers that are not dmabufs */
+internal headless_dmabuf *
+dmabuf_buffer_get(wl_resource *buffer)
+{
+    if (!wl_resource_instance_of(buffer, &wl_buffer_interface, &dmabuf_buffer_implementation))
+    {
+        return NULL;
+    }
+    return (headless_dmabuf*)wl_resource_get_user_data(buffer);
+}
+
+internal void
+dmabuf_params_add(wl_client *client, wl_resource *resource, s32 fd, u32 plane_idx,
+    u32 offset, u32 stride, u32 modifier_hi, u32 modifier_lo)
+{
+    headless_dmabuf_params *params = (headless_dmabuf_params*)wl_resource_get_user_data(resource);
+    if (params->used)
+    {
+        close(fd);
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+            "params were already used");
+        return;
+    }
+    if (plane_idx != 0)
+    {
+        close(fd);
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+            "plane %u out of bounds, only single-plane formats are supported", plane_idx);
+        return;
+    }
+    if (params->fd >= 0)
+    {
+        close(fd);
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+            "plane 0 was already set");
+        return;
+    }
+    params->fd = fd;
+    params->offset = offset;
+    params->stride = stride;
+    params->modifier = (u64)modifier_hi << 32 | modifier_lo;
+}
+
+/* Validates the params and maps the dmabuf, which is all the import a
+ * CPU compositor needs. Returns NULL after posting a protocol error for
+ * client mistakes; a dmabuf that could not be mapped has no `data`. */
+internal headless_dmabuf *
+dmabuf_params_import(wl_client *client, wl_resource *resource, s32 width, s32 height, u32 format)
+{
+    headless_dmabuf_params *params = (headless_dmabuf_params*)wl_resource_get_user_data(resource);
+    if (params->used)
+    {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+            "params were already used");
+        return NULL;
+    }
+    params->used = true;
+    if (params->fd < 0)
+    {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+            "no plane was added");
+        return NULL;
+    }
+
+    const headless_dmabuf_format *known = NULL;
+    for (u32 i = 0; i < sizeof(headless_dmabuf_formats) / sizeof(headless_dmabuf_formats[0]); ++i)
+    {
+        if (headless_dmabuf_formats[i].drm_format == format)
+        {
+            known = &headless_dmabuf_formats[i];
+        }
+    }
+    /* Only the linear layout was announced */
+    if (!known || params->modifier != 0)
+    {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+            "format 0x%08x with modifier 0x%016llx is not supported",
+            format, (unsigned long long)params->modifier);
+        return NULL;
+    }
+    if (width <= 0 || height <= 0)
+    {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+            "invalid size %dx%d", width, height);
+        return NULL;
+    }
+
+    /* dmabufs report their size through lseek */
+    off_t size = lseek(params->fd, 0, SEEK_END);
+    u64 end = params->offset + (u64)params->stride * height;
+    if (params->stride < (u64)width * known->bytes_per_pixel || (size >= 0 && end > (u64)size))
+    {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+            "plane does not fit the dmabuf");
+        return NULL;
+    }
+
+    headless_dmabuf *dmabuf = (headless_dmabuf*)calloc(1, sizeof(headless_dmabuf));
+    if (!dmabuf)
+    {
+        wl_client_post_no_memory(client);
+        return NULL;
+    }
+    /* The wl_buffer owns the fd from here */
+    dmabuf->fd = params->fd;
+    params->fd = -1;
+    dmabuf->width = width;
+    dmabuf->height = height;
+    dmabuf->stride = params->stride;
+    dmabuf->size = (size_t)end;
+    void *data = mmap(NULL, dmabuf->size, PROT_READ, MAP_SHARED, dmabuf->fd, 0);
+    if (data != MAP_FAILED)
+    {
+        dmabuf->data = data;
+    }
+    else
+    {
+        ++params->server->stats.import_failures;
+    }
+    return dmabuf;
+}
+
+internal wl_resource *
+dmabuf_buffer_create(wl_client *client, headless_dmabuf *dmabuf, u32 id)
+{
+    wl_resource *buffer = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    if (!buffer)
+    {
+        headless_dmabuf_free(dmabuf);
+        wl_client_post_no_memory(client);
+        return NULL;
+    }
+    wl_resource_set_implementation(buffer, &dmabuf_buffer_implementation,
+        dmabuf, dmabuf_buffer_resource_destroyed);
+    return buffer;
+}
+
+internal void
+dmabuf_params_create(wl_client *client, wl_resource *resource,
+    s32 width, s32 height, u32 format, u32 flags)
+{
+    headless_dmabuf *dmabuf = dmabuf_params_import(client, resource, width, height, format);
+    if (!dmabuf)
+    {
+        return;
+    }
+    if (!dmabuf->data)
+    {
+        headless_dmabuf_free(dmabuf);
+        zwp_linux_buffer_params_v1_send_failed(resource);
+        return;
+    }
+    /* Id 0 has the server allocate the wl_buffer */
+    wl_resource *buffer = dmabuf_buffer_create(client, dmabuf, 0);
+    if (buffer)
+    {
+        zwp_linux_buffer_params_v1_send_created(resource, buffer);
+    }
+}
+
+/* A failed import still gets its wl_buffer, since the client already
+ * holds the id */
+internal void
+dmabuf_params_create_immed(wl_client *client, wl_resource *resource, u32 buffer_id,
+    s32 width, s32 height, u32 format, u32 flags)
+{
+    headless_dmabuf *dmabuf = dmabuf_params_import(client, resource, width, height, format);
+    if (!dmabuf)
+    {
+        return;
+    }
+    b8 failed = !dmabuf->data;
+    if (dmabuf_buffer_create(client, dmabuf, buffer_id) && failed)
+    {
+        zwp_linux_buffer_params_v1_send_failed(resource);
+    }
+}
+
+global_variable struct zwp_linux_buffer_params_v1_interface dmabuf_params_implementation =
+{
+    .destroy = destroy_resource,
+    .add = dmabuf_params_add,
+    .create = dmabuf_params_create,
+    .create_immed = dmabuf_params_create_immed,
+};
+
+internal void
+dmabuf_params_resource_destroyed(wl_resource *resource)
+{
+    headless_dmabuf_params *params = (headless_dmabuf_params*)wl_resource_get_user_data(resource);
+    if (params->fd >= 0)
+    {
+        close(params->fd);
+    }
+    free(params);
+}
+
+internal void
+linux_dmabuf_create_params(wl_client *client, wl_resource *resource, u32 params_id)
+{
+    headless_dmabuf_params *params =
+        (headless_dmabuf_params*)calloc(1, sizeof(headless_dmabuf_params));
+    if (!params)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    params->server = (server_state*)wl_resource_get_user_data(resource);
+    params->fd = -1;
+
+    wl_resource *params_resource = wl_resource_create(client,
+        &zwp_linux_buffer_params_v1_interface, wl_resource_get_version(resource), params_id);
+    if (!params_resource)
+    {
+        free(params);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(params_resource, &dmabuf_params_implementation,
+        params, dmabuf_params_resource_destroyed);
+}
+
+/* Feedback objects only exist from version 4, which is not advertised */
+internal void
+linux_dmabuf_get_default_feedback(wl_client *client, wl_resource *resource, u32 id)
+{
+    wl_client_post_implementation_error(client, "dmabuf feedback is not supported");
+}
+
+internal void
+linux_dmabuf_get_surface_feedback(wl_client *client, wl_resource *resource, u32 id,
+    wl_resource *surface)
+{
+    wl_client_post_implementation_error(client, "dmabuf feedback is not supported");
+}
+
+global_variable struct zwp_linux_dmabuf_v1_interface linux_dmabuf_implementation =
 {
+    .destroy = destroy_resource,
+    .create_params = linux_dmabuf_create_params,
+    .get_default_feedback = linux_dmabuf_get_default_feedback,
+    .get_surface_feedback = linux_dmabuf_get_surface_feedback,
+};
+
+internal void
+linux_dmabuf_bind(wl_client *client, void *data, u32 version, u32 id)
+{
+    wl_resource *resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface,
+        version, id);
+    if (!resource)
+    {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &linux_dmabuf_implementation, data, NULL);
+    for (u32 i = 0; i < sizeof(headless_dmabuf_formats) / sizeof(headless_dmabuf_formats[0]); ++i)
+    {
+        u32 format = headless_dmabuf_formats[i].drm_format;
+        zwp_linux_dmabuf_v1_send_format(resource, format);
+        if (version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION)
+        {
+            /* DRM_FORMAT_MOD_LINEAR */
+            zwp_linux_dmabuf_v1_send_modifier(resource, format, 0, 0);
+        }
+    }
+}
+
+/// REFRESH
+
+/* Copies a committed shm buffer the way a renderer would upload it, or
+ * samples an imported dmabuf in place, then hands the buffer back to the
+ * client */
+internal void
+surface_present_buffer(headless_surface *surface)
+{
+    server_stats *stats = &surface->server->stats;
+    s32 width = -1;
+    s32 height = -1;
+    wl_shm_buffer *shm_buffer = wl_shm_buffer_get(surface->buffer);
+    headless_dmabuf *dmabuf = dmabuf_buffer_get(surface->buffer);
+    if (shm_buffer)
+    {
+        width = wl_shm_buffer_get_width(shm_buffer);
+        height = wl_shm_buffer_get_height(shm_buffer);
+        size_t size = (size_t)wl_shm_buffer_get_stride(shm_buffer) * height;
+        if (size > surface->pixels_size)
+        {
+            free(surface->pixels);
+            surface->pixels = (u8*)malloc(size);
+            surface->pixels_size = surface->pixels ? size : 0;
+        }
+        if (surface->pixels)
+        {
+            wl_shm_buffer_begin_access(shm_buffer);
+            memcpy(surface->pixels, wl_shm_buffer_get_data(shm_buffer), size);
+            wl_shm_buffer_end_access(shm_buffer);
+            stats->bytes_copied += size;
+        }
+    }
+    else if (dmabuf && dmabuf->data)
+    {
+        width = dmabuf->width;
+        height = dmabuf->height;
+        ++stats->imported;
+        stats->bytes_imported += (u64)dmabuf->stride * dmabuf->height;
+    }
+
+    if (width != -1 && surface->destination_width != -1 &&
+        (surface->destination_width != width || surface->destination_height != height))
+    {
+        ++stats->scaled;
+    }
+
+    wl_buffer_send_release(surface->buffer);
+    surface_set_buffer(surface, NULL);
+}
+
+/* The timer has millisecond resolution and a delay of 0 disarms it, so
+ * the delay is rounded up. Rates above 1000 Hz fire late and are caught
+ * up by the missed cycle accounting. */
+internal void
+server_arm_refresh(server_state *server, u64 now)
+{
+    u64 delay_ns = server->next_refresh_ns - now;
+    wl_event_source_timer_update(server->refresh_timer, (int)((delay_ns + 999999) / 1000000));
+}
+
+internal int
+server_refresh(void *data)
+{
+    server_state *server = (server_state*)data;
+    u64 now = clock_ns();
+    ++server->msc;
+    ++server->stats.refreshes;
+
+    u32 tv_sec_hi = (u32)((now / 1000000000ull) >> 32);
+    u32 tv_sec_lo = (u32)(now / 1000000000ull);
+    u32 tv_nsec = (u32)(now % 1000000000ull);
+    u32 time_ms = (u32)(now / 1000000ull);
+
+    headless_surface *surface;
+    wl_list_for_each(surface, &server->surfaces, link)
+    {
+        if (surface->buffer)
+        {
+            surface_present_buffer(surface);
+        }
+
+        wl_resource *resource, *tmp;
+        wl_resource_for_each_safe(resource, tmp, &surface->feedbacks)
+        {
+            wp_presentation_feedback_send_presented(resource, tv_sec_hi, tv_sec_lo, tv_nsec,
+                (u32)server->refresh_ns, (u32)(server->msc >> 32), (u32)server->msc, 0);
+            wl_resource_destroy(resource);
+            ++server->stats.presented;
+        }
+        wl_resource_for_each_safe(resource, tmp, &surface->frames)
+        {
+            wl_callback_send_done(resource, time_ms);
+            wl_resource_destroy(resource);
+        }
+    }
+
+    if (server->max_refreshes && server->stats.refreshes >= server->max_refreshes)
+    {
+        wl_display_terminate(server->wl_display);
+        return 0;
+    }
+
+    /* Schedule against absolute deadlines so rounding to milliseconds does
+     * not drift, and skip cycles that were missed entirely */
+    server->next_refresh_ns += server->refresh_ns;
+    while (server->next_refresh_ns <= now)
+    {
+        server->next_refresh_ns += server->refresh_ns;
+        ++server->msc;
+        ++server->stats.missed_refreshes;
+    }
+    server_arm_refresh(server, now);
+    return 0;
+}
+
+internal int
+server_handle_signal(int signal_number, void *data)
+{
+    server_state *server = (server_state*)data;
+    wl_display_terminate(server->wl_display);
+    return 0;
+}
+
+internal void
+server_print_stats(server_state *server)
+{
+    timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    f64 seconds = (end.tv_sec - server->start.tv_sec) +
+        (end.tv_nsec - server->start.tv_nsec) / 1e9;
+    if (seconds <= 0)
+    {
+        seconds = 1;
+    }
+
+    fprintf(stderr, "headless: %llu refreshes (%llu missed), %llu commits, "
+        "%llu presented, %llu discarded, %llu scaled\n",
+        (unsigned long long)server->stats.refreshes,
+        (unsigned long long)server->stats.missed_refreshes,
+        (unsigned long long)server->stats.commits,
+        (unsigned long long)server->stats.presented,
+        (unsigned long long)server->stats.discarded,
+        (unsigned long long)server->stats.scaled
+    );
+    fprintf(stderr, "headless: %.1f frames/s presented, %.1f MiB/s copied over %.2f s\n",
+        server->stats.presented / seconds,
+        server->stats.bytes_copied / seconds / (1024.0 * 1024.0),
+        seconds
+    );
+    if (server->stats.imported || server->stats.import_failures)
+    {
+        fprintf(stderr, "headless: %llu dmabuf frames presented without a copy, "
+            "%.1f MiB/s not copied, %llu failed imports\n",
+            (unsigned long long)server->stats.imported,
+            server->stats.bytes_imported / seconds / (1024.0 * 1024.0),
+            (unsigned long long)server->stats.import_failures
+        );
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    server_state server = {};
+    u32 refresh_hz = HEADLESS_DEFAULT_REFRESH_HZ;
+    const char *socket_name = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--refresh-hz") == 0 && i + 1 < argc)
+        {
+            refresh_hz = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &server.configure_width,
+                &server.configure_height) != 2)
+            {
+                fprintf(stderr, "invalid size '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            server.max_refreshes = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+        {
+            socket_name = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--refresh-hz n] [--size WxH] [--frames n] "
+                "[--socket name]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (refresh_hz == 0)
+    {
+        refresh_hz = HEADLESS_DEFAULT_REFRESH_HZ;
+    }
+
     int return_code = 0;
     struct wl_display *display = wl_display_create();
     const char *socket = NULL;
 
     if(display)
     {
-        socket = wl_display_add_socket_auto(display);
+        if (socket_name)
+        {
+            socket = wl_display_add_socket(display, socket_name) == 0 ? socket_name : NULL;
+        }
+        else
+        {
+            socket = wl_display_add_socket_auto(display);
+        }
     }
 
     if(socket)
     {
-        fprintf(stderr, "Running Wayland Display on %s\n", socket);
+        server.wl_display = display;
+        server.wl_event_loop = wl_display_get_event_loop(display);
+        server.refresh_ns = 1000000000ull / refresh_hz;
+        wl_list_init(&server.surfaces);
+
+        wl_display_init_shm(display);
+        /* ARGB8888 and XRGB8888 are implied, see the client's --format */
+        wl_display_add_shm_format(display, WL_SHM_FORMAT_RGB565);
+        wl_global_create(display, &wl_compositor_interface, 4, &server, compositor_bind);
+        wl_global_create(display, &xdg_wm_base_interface, HEADLESS_XDG_WM_BASE_VERSION,
+            &server, xdg_wm_base_bind);
+        wl_global_create(display, &wp_presentation_interface, 1, &server, presentation_bind);
+        wl_global_create(display, &wp_viewporter_interface, 1, &server, viewporter_bind);
+        /* Version 4 replaces the format events with feedback objects */
+        wl_global_create(display, &zwp_linux_dmabuf_v1_interface, 3, &server, linux_dmabuf_bind);
+
+        wl_event_loop_add_signal(server.wl_event_loop, SIGINT, server_handle_signal, &server);
+        wl_event_loop_add_signal(server.wl_event_loop, SIGTERM, server_handle_signal, &server);
+        server.refresh_timer = wl_event_loop_add_timer(server.wl_event_loop,
+            server_refresh, &server);
+        clock_gettime(CLOCK_MONOTONIC, &server.start);
+        u64 now = clock_ns();
+        server.next_refresh_ns = now + server.refresh_ns;
+        server_arm_refresh(&server, now);
+
+        fprintf(stderr, "Running headless Wayland Display on %s at %u Hz\n", socket, refresh_hz);
         wl_display_run(display);
+
+        server_print_stats(&server);
+        wl_event_source_remove(server.refresh_timer);
+        wl_display_destroy_clients(display);
         wl_display_destroy(display);
     }
     else
@@ -0,0 +1,461 @@
+#define BUFFER_POOL_MIN_BUFFERS 2
+#define BUFFER_POOL_MAX_BUFFERS 4
+/* Surfaces at least this large are allocated with SHM_ALLOC_HUGE when the
+ * pool has huge pages enabled, roughly a 1080p XRGB8888 buffer */
+#define BUFFER_POOL_HUGE_THRESHOLD (8 * 1024 * 1024)
+/* Storage that a resize outgrows is replaced by at least GROWTH times as
+ * much, and always with 1/HEADROOM more than the new size needs, so that
+ * a drag-resize reallocates a handful of times rather than every frame.
+ * Storage more than SHRINK times what is needed is released. */
+#define BUFFER_POOL_GROWTH 2
+#define BUFFER_POOL_HEADROOM 4
+#define BUFFER_POOL_SHRINK 4
+
+/* One mapped shm buffer that stays alive across frames. It is busy from
+ * the moment it is handed out until the compositor sends wl_buffer.release.
+ * The storage behind it can be larger than the buffer, so that a resize
+ * only needs a new wl_buffer over the same wl_shm_pool, or over the same
+ * dmabuf when the storage is shared through zwp_linux_dmabuf_v1. */
+struct pool_buffer
+{
+    wl_buffer *wl_buffer;
+    wl_shm_pool *wl_shm_pool;
+    /* Set instead of wl_shm_pool for udmabuf storage. The params object
+     * lives as long as its wl_buffer to hear about a failed import. */
+    b8 dmabuf;
+    int dmabuf_fd;
+    zwp_linux_buffer_params_v1 *dmabuf_params;
+    b8 dmabuf_failed;
+    void *data;
+    /* Of the storage, not of the buffer */
+    size_t size;
+    s32 width;
+    s32 height;
+    s32 stride;
+    pixel_format format;
+    /* Animation offset the pixels were last drawn at, -1 when undefined.
+     * Lets renderers update a reused buffer instead of redrawing it. */
+    s32 content_offset;
+    b8 busy;
+};
+
+struct buffer_pool_stats
+{
+    u64 hits;
+    u64 allocations;
+    u64 bytes_allocated;
+    /* Resizes that fit the existing storage */
+    u64 reshapes;
+    u64 stalls;
+    /* Of the allocations, those shared as a udmabuf, those that fell back
+     * to wl_shm and imports the compositor refused */
+    u64 dmabuf_allocations;
+    u64 dmabuf_fallbacks;
+    u64 dmabuf_failures;
+};
+
+struct buffer_pool
+{
+    wl_shm *wl_shm;
+    /* With both set, storage is offered as a udmabuf first */
+    zwp_linux_dmabuf_v1 *linux_dmabuf;
+    int udmabuf_fd;
+    /* After a refused import, the rest of the pool's life is wl_shm */
+    b8 dmabuf_failed;
+    u32 count;
+    s32 width;
+    s32 height;
+    pixel_format format;
+    b8 huge_pages;
+    /* Storage exactly the size of each buffer, as before the growth
+     * policy. Only for comparing the two in the resize benchmark. */
+    b8 exact_size;
+    /* Of the most recent allocation, the size every buffer grows towards */
+    size_t storage_size;
+    pool_buffer buffers[BUFFER_POOL_MAX_BUFFERS];
+    buffer_pool_stats stats;
+};
+
+internal void
+pool_buffer_release(void *data, wl_buffer *wl_buffer)
+{
+    pool_buffer *buffer = (pool_buffer*)data;
+    buffer->busy = false;
+}
+
+global_variable wl_buffer_listener pool_buffer_listener = {
+    .release = pool_buffer_release,
+};
+
+internal void
+pool_buffer_params_created(void *data, zwp_linux_buffer_params_v1 *params, wl_buffer *wl_buffer)
+{
+    // empty, only sent for create, not create_immed
+}
+
+/* The wl_buffer is unusable, buffer_pool_acquire replaces it */
+internal void
+pool_buffer_params_failed(void *data, zwp_linux_buffer_params_v1 *params)
+{
+    pool_buffer *buffer = (pool_buffer*)data;
+    buffer->dmabuf_failed = true;
+}
+
+global_variable zwp_linux_buffer_params_v1_listener pool_buffer_params_listener = {
+    .created = pool_buffer_params_created,
+    .failed = pool_buffer_params_failed,
+};
+
+internal void
+pool_buffer_destroy(pool_buffer *buffer)
+{
+    if (buffer->wl_buffer)
+    {
+        wl_buffer_destroy(buffer->wl_buffer);
+    }
+    if (buffer->wl_shm_pool)
+    {
+        wl_shm_pool_destroy(buffer->wl_shm_pool);
+    }
+    if (buffer->dmabuf_params)
+    {
+        zwp_linux_buffer_params_v1_destroy(buffer->dmabuf_params);
+    }
+    if (buffer->dmabuf)
+    {
+        close(buffer->dmabuf_fd);
+    }
+    if (buffer->data)
+    {
+        munmap(buffer->data, buffer->size);
+    }
+    *buffer = {};
+}
+
+/* Carves a buffer of the pool's current size out of the existing storage */
+internal void
+pool_buffer_reshape(buffer_pool *pool, pool_buffer *buffer)
+{
+    if (buffer->wl_buffer)
+    {
+        wl_buffer_destroy(buffer->wl_buffer);
+    }
+    s32 stride = pool->width * pixel_format_bytes(pool->format);
+    if (buffer->dmabuf)
+    {
+        if (buffer->dmabuf_params)
+        {
+            zwp_linux_buffer_params_v1_destroy(buffer->dmabuf_params);
+        }
+        buffer->dmabuf_params = zwp_linux_dmabuf_v1_create_params(pool->linux_dmabuf);
+        zwp_linux_buffer_params_v1_add_listener(buffer->dmabuf_params,
+            &pool_buffer_params_listener, buffer);
+        zwp_linux_buffer_params_v1_add(buffer->dmabuf_params, buffer->dmabuf_fd, 0, 0, stride,
+            (u32)(DRM_FORMAT_MOD_LINEAR >> 32), (u32)DRM_FORMAT_MOD_LINEAR);
+        buffer->wl_buffer = zwp_linux_buffer_params_v1_create_immed(buffer->dmabuf_params,
+            pool->width, pool->height, pixel_formats[pool->format].drm_format, 0);
+    }
+    else
+    {
+        buffer->wl_buffer = wl_shm_pool_create_buffer(
+            buffer->wl_shm_pool,
+            0,
+            pool->width,
+            pool->height,
+            stride,
+            pixel_formats[pool->format].wl_format
+        );
+    }
+    wl_buffer_add_listener(buffer->wl_buffer, &pool_buffer_listener, buffer);
+    TRACE_FRAME_STAGE(FRAME_STAGE_BUFFER);
+
+    buffer->width = pool->width;
+    buffer->height = pool->height;
+    buffer->stride = stride;
+    buffer->format = pool->format;
+    buffer->content_offset = -1;
+    buffer->busy = false;
+}
+
+internal b8
+buffer_pool_storage_fits(buffer_pool *pool, size_t storage, size_t needed)
+{
+    return !pool->exact_size && storage >= needed && storage / BUFFER_POOL_SHRINK < needed;
+}
+
+internal size_t
+buffer_pool_storage_size(buffer_pool *pool, size_t needed)
+{
+    if (pool->exact_size)
+    {
+        return needed;
+    }
+    if (buffer_pool_storage_fits(pool, pool->storage_size, needed))
+    {
+        return pool->storage_size;
+    }
+    size_t size = needed + needed / BUFFER_POOL_HEADROOM;
+    if (pool->storage_size < needed && pool->storage_size * BUFFER_POOL_GROWTH > size)
+    {
+        size = pool->storage_size * BUFFER_POOL_GROWTH;
+    }
+    /* wl_shm_pool sizes are an int32_t */
+    if (size > INT32_MAX)
+    {
+        size = needed;
+    }
+    return size;
+}
+
+internal b8
+pool_buffer_create(buffer_pool *pool, pool_buffer *buffer)
+{
+    size_t needed = (size_t)pool->width * pixel_format_bytes(pool->format) * pool->height;
+    size_t size = buffer_pool_storage_size(pool, needed);
+    b8 try_dmabuf = pool->udmabuf_fd >= 0 && !pool->dmabuf_failed;
+    if (try_dmabuf)
+    {
+        /* udmabuf only takes whole pages */
+        size_t page = sysconf(_SC_PAGESIZE);
+        size = (size + page - 1) / page * page;
+    }
+
+    u32 flags = 0;
+    if (pool->huge_pages && size >= BUFFER_POOL_HUGE_THRESHOLD)
+    {
+        flags |= SHM_ALLOC_HUGE;
+    }
+
+    /* May round size up to whole huge pages */
+    int fd = allocate_shm_file_flags(&size, flags);
+    if (fd == -1)
+    {
+        return false;
+    }
+    TRACE_FRAME_STAGE(FRAME_STAGE_ALLOC);
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    if (flags & SHM_ALLOC_HUGE)
+    {
+        shm_advise_huge(data, size);
+    }
+    TRACE_FRAME_STAGE(FRAME_STAGE_MAP);
+
+    /* The dmabuf or the wl_shm_pool keeps the storage alive on the
+     * compositor side, so the fd is not needed after this. Either stays
+     * around for later reshapes. */
+    if (try_dmabuf)
+    {
+        int dmabuf_fd = udmabuf_wrap(pool->udmabuf_fd, fd, size);
+        if (dmabuf_fd >= 0)
+        {
+            buffer->dmabuf = true;
+            buffer->dmabuf_fd = dmabuf_fd;
+            ++pool->stats.dmabuf_allocations;
+        }
+        else
+        {
+            ++pool->stats.dmabuf_fallbacks;
+        }
+    }
+    if (!buffer->dmabuf)
+    {
+        buffer->wl_shm_pool = wl_shm_create_pool(pool->wl_shm, fd, size);
+    }
+    close(fd);
+    buffer->data = data;
+    buffer->size = size;
+    pool_buffer_reshape(pool, buffer);
+
+    pool->storage_size = size;
+    ++pool->stats.allocations;
+    pool->stats.bytes_allocated += size;
+    return true;
+}
+
+internal void
+buffer_pool_init(buffer_pool *pool, wl_shm *wl_shm, u32 count,
+    pixel_format format = PIXEL_FORMAT_XRGB8888)
+{
+    *pool = {};
+    pool->wl_shm = wl_shm;
+    pool->udmabuf_fd = -1;
+    pool->format = format;
+
+    if (count < BUFFER_POOL_MIN_BUFFERS)
+    {
+        count = BUFFER_POOL_MIN_BUFFERS;
+    }
+    else if (count > BUFFER_POOL_MAX_BUFFERS)
+    {
+        count = BUFFER_POOL_MAX_BUFFERS;
+    }
+    pool->count = count;
+}
+
+/* Makes new storage udmabufs submitted through `linux_dmabuf`, which must
+ * support the pool's format with DRM_FORMAT_MOD_LINEAR. Returns false,
+ * leaving the pool on wl_shm, when /dev/udmabuf cannot be opened. Storage
+ * the kernel refuses to wrap, e.g. from shm_open, still goes to wl_shm. */
+internal b8
+buffer_pool_enable_dmabuf(buffer_pool *pool, zwp_linux_dmabuf_v1 *linux_dmabuf)
+{
+    pool->udmabuf_fd = udmabuf_open();
+    if (pool->udmabuf_fd < 0)
+    {
+        return false;
+    }
+    pool->linux_dmabuf = linux_dmabuf;
+    return true;
+}
+
+/* Pixels written through the mapping are made visible to the importer */
+internal void
+pool_buffer_begin_access(pool_buffer *buffer)
+{
+    if (buffer->dmabuf)
+    {
+        dmabuf_sync(buffer->dmabuf_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+    }
+}
+
+internal void
+pool_buffer_end_access(pool_buffer *buffer)
+{
+    if (buffer->dmabuf)
+    {
+        dmabuf_sync(buffer->dmabuf_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
+    }
+}
+
+/* Pixels another buffer is copied from, e.g. the previous frame while
+ * scrolling, are read coherently with what the importer wrote */
+internal void
+pool_buffer_begin_read(pool_buffer *buffer)
+{
+    if (buffer->dmabuf)
+    {
+        dmabuf_sync(buffer->dmabuf_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    }
+}
+
+internal void
+pool_buffer_end_read(pool_buffer *buffer)
+{
+    if (buffer->dmabuf)
+    {
+        dmabuf_sync(buffer->dmabuf_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    }
+}
+
+/* Hands out the first free buffer of the requested size, allocating one
+ * only when no buffer of that size exists yet and none has the storage
+ * for it. Returns NULL when every buffer is still held by the compositor. */
+internal pool_buffer *
+buffer_pool_acquire(buffer_pool *pool, s32 width, s32 height)
+{
+    pool->width = width;
+    pool->height = height;
+
+    /* Buffers of an old size are resized as soon as they are released,
+     * in place when their storage allows */
+    size_t needed = (size_t)width * pixel_format_bytes(pool->format) * height;
+    for (u32 i = 0; i < pool->count; ++i)
+    {
+        pool_buffer *buffer = &pool->buffers[i];
+        /* A refused import is replaced right away, the compositor will
+         * never release it */
+        if (buffer->dmabuf_failed)
+        {
+            pool_buffer_destroy(buffer);
+            pool->dmabuf_failed = true;
+            ++pool->stats.dmabuf_failures;
+        }
+        if (buffer->wl_buffer && !buffer->busy &&
+            (buffer->width != width || buffer->height != height))
+        {
+            /* Once the compositor has refused an import, reshaping a
+             * udmabuf would only ask it again. Its storage is dropped
+             * instead and comes back as wl_shm. */
+            b8 reimport = buffer->dmabuf && pool->dmabuf_failed;
+            if (!reimport && buffer_pool_storage_fits(pool, buffer->size, needed))
+            {
+                pool_buffer_reshape(pool, buffer);
+                ++pool->stats.reshapes;
+            }
+            else
+            {
+                pool_buffer_destroy(buffer);
+            }
+        }
+    }
+
+    for (u32 i = 0; i < pool->count; ++i)
+    {
+        pool_buffer *buffer = &pool->buffers[i];
+        if (buffer->wl_buffer && !buffer->busy)
+        {
+            ++pool->stats.hits;
+            buffer->busy = true;
+            return buffer;
+        }
+    }
+
+    for (u32 i = 0; i < pool->count; ++i)
+    {
+        pool_buffer *buffer = &pool->buffers[i];
+        if (!buffer->wl_buffer)
+        {
+            if (!pool_buffer_create(pool, buffer))
+            {
+                return NULL;
+            }
+            buffer->busy = true;
+            return buffer;
+        }
+    }
+
+    ++pool->stats.stalls;
+    return NULL;
+}
+
+internal void
+buffer_pool_destroy(buffer_pool *pool)
+{
+    for (u32 i = 0; i < BUFFER_POOL_MAX_BUFFERS; ++i)
+    {
+        pool_buffer_destroy(&pool->buffers[i]);
+    }
+    if (pool->udmabuf_fd >= 0)
+    {
+        close(pool->udmabuf_fd);
+        pool->udmabuf_fd = -1;
+    }
+}
+
+internal void
+buffer_pool_print_stats(buffer_pool *pool)
+{
+    fprintf(stderr, "buffer pool: %llu hits, %llu allocations (%.1f MiB), "
+        "%llu reshapes, %llu stalls\n",
+        (unsigned long long)pool->stats.hits,
+        (unsigned long long)pool->stats.allocations,
+        pool->stats.bytes_allocated / (1024.0 * 1024.0),
+        (unsigned long long)pool->stats.reshapes,
+        (unsigned long long)pool->stats.stalls
+    );
+    if (pool->linux_dmabuf)
+    {
+        fprintf(stderr, "buffer pool: %llu allocations as udmabuf, %llu fell back to wl_shm, "
+            "%llu imports refused\n",
+            (unsigned long long)pool->stats.dmabuf_allocations,
+            (unsigned long long)pool->stats.dmabuf_fallbacks,
+            (unsigned long long)pool->stats.dmabuf_failures
+        );
+    }
+}
@@ -0,0 +1,22 @@
+/* Monotonic nanosecond timestamps, and the comparator timing samples are
+ * sorted with before percentiles are read off them. Clocks with other
+ * needs, like the presentation clock, stay with their module. */
+
+#include <time.h>
+
+internal u64
+clock_ns(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* qsort comparator for u64 */
+internal int
+compare_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64*)a;
+    u64 y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
@@ -0,0 +1,135 @@
+/* Upper bound on the rectangles sent per commit. Once it is reached the two
+ * rectangles whose union wastes the least area are merged. */
+#define DAMAGE_MAX_RECTS 8
+
+struct damage_rect
+{
+    s32 x0;
+    s32 y0;
+    s32 x1;
+    s32 y1;
+};
+
+struct damage_region
+{
+    /* One spare slot holds the incoming rectangle while choosing a merge */
+    damage_rect rects[DAMAGE_MAX_RECTS + 1];
+    u32 count;
+};
+
+internal s64
+damage_rect_area(damage_rect rect)
+{
+    return (s64)(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+}
+
+internal damage_rect
+damage_rect_union(damage_rect a, damage_rect b)
+{
+    damage_rect result;
+    result.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+    result.y0 = a.y0 < b.y0 ? a.y0 : b.y0;
+    result.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+    result.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+    return result;
+}
+
+/* Touching rectangles count as overlapping so adjacent strips coalesce */
+internal b8
+damage_rect_touches(damage_rect a, damage_rect b)
+{
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+internal void
+damage_region_clear(damage_region *region)
+{
+    region->count = 0;
+}
+
+internal void
+damage_region_remove(damage_region *region, u32 index)
+{
+    region->rects[index] = region->rects[--region->count];
+}
+
+internal void
+damage_region_add(damage_region *region, s32 x, s32 y, s32 width, s32 height)
+{
+    if (width <= 0 || height <= 0)
+    {
+        return;
+    }
+
+    damage_rect rect = { x, y, x + width, y + height };
+
+    /* Fold in every rectangle whose union with the new one costs no more
+     * area than keeping both. Merging can make the result reach rectangles
+     * that were skipped before, so start over after each merge. */
+    for (u32 i = 0; i < region->count;)
+    {
+        damage_rect other = region->rects[i];
+        damage_rect merged = damage_rect_union(rect, other);
+        if (damage_rect_touches(rect, other) &&
+            damage_rect_area(merged) <= damage_rect_area(rect) + damage_rect_area(other))
+        {
+            rect = merged;
+            damage_region_remove(region, i);
+            i = 0;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    if (region->count == DAMAGE_MAX_RECTS)
+    {
+        u32 best_a = 0;
+        u32 best_b = 1;
+        s64 best_waste = INT64_MAX;
+        region->rects[region->count++] = rect;
+        for (u32 a = 0; a < region->count; ++a)
+        {
+            for (u32 b = a + 1; b < region->count; ++b)
+            {
+                damage_rect ra = region->rects[a];
+                damage_rect rb = region->rects[b];
+                s64 waste = damage_rect_area(damage_rect_union(ra, rb)) -
+                    damage_rect_area(ra) - damage_rect_area(rb);
+                if (waste < best_waste)
+                {
+                    best_waste = waste;
+                    best_a = a;
+                    best_b = b;
+                }
+            }
+        }
+        rect = damage_rect_union(region->rects[best_a], region->rects[best_b]);
+        damage_region_remove(region, best_b);
+        damage_region_remove(region, best_a);
+        damage_region_add(region, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+        return;
+    }
+
+    region->rects[region->count++] = rect;
+}
+
+/* Sends the accumulated rectangles in buffer coordinates and resets the
+ * region. Needs wl_surface version 4. */
+internal void
+damage_region_submit(damage_region *region, wl_surface *wl_surface)
+{
+    for (u32 i = 0; i < region->count; ++i)
+    {
+        damage_rect rect = region->rects[i];
+        wl_surface_damage_buffer(
+            wl_surface,
+            rect.x0,
+            rect.y0,
+            rect.x1 - rect.x0,
+            rect.y1 - rect.y0
+        );
+    }
+    damage_region_clear(region);
+}
@@ -0,0 +1,276 @@
+/* Binary event log. Any thread appends fixed-size records to a ring of its
+ * own with a handful of stores and no syscall; a background writer wakes
+ * every few milliseconds, merges what the rings hold by timestamp and
+ * either formats it as text or writes it raw to a file. Raw logs are
+ * turned back into text by logdump. The record layout and
+ * event_log_format live in event_log_record.cpp.
+ *
+ *     event_log_record *record = event_log_begin(EVENT_LOG_KEY);
+ *     if (record)
+ *     {
+ *         record->fields[0] = ...;
+ *         event_log_commit();
+ *     }
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+/* Power of two */
+#define EVENT_LOG_RING_SIZE 4096
+#define EVENT_LOG_MAX_THREADS 16
+#define EVENT_LOG_FLUSH_INTERVAL_NS 5000000ull
+
+/* Written only by its thread (head, dropped) and the writer (tail) */
+struct event_log_ring
+{
+    alignas(64) u32 head;
+    u64 dropped;
+    alignas(64) u32 tail;
+    u32 index;
+    event_log_record records[EVENT_LOG_RING_SIZE];
+};
+
+struct event_log_stats
+{
+    u64 written;
+    u64 flushes;
+    u64 dropped;
+    u32 threads;
+};
+
+struct event_log
+{
+    b8 running;
+    b8 quit;
+    pthread_t writer;
+    pthread_mutex_t attach_mutex;
+    FILE *file;
+
+    event_log_ring *rings[EVENT_LOG_MAX_THREADS];
+    u32 ring_count;
+
+    event_log_record *scratch;
+    u32 scratch_size;
+    event_log_stats stats;
+};
+
+global_variable event_log event_log_state;
+global_variable thread_local event_log_ring *event_log_thread_ring;
+
+/// WRITING
+
+/* First record from a thread, gives it a ring. Returns NULL once every
+ * ring is taken. */
+internal event_log_ring *
+event_log_attach(void)
+{
+    event_log_ring *ring = NULL;
+    pthread_mutex_lock(&event_log_state.attach_mutex);
+    u32 count = event_log_state.ring_count;
+    if (count < EVENT_LOG_MAX_THREADS)
+    {
+        ring = (event_log_ring*)aligned_alloc(64, sizeof(event_log_ring));
+        if (ring)
+        {
+            memset(ring, 0, sizeof(*ring));
+            ring->index = count;
+            event_log_state.rings[count] = ring;
+            __atomic_store_n(&event_log_state.ring_count, count + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&event_log_state.attach_mutex);
+    event_log_thread_ring = ring;
+    return ring;
+}
+
+/* Returns the calling thread's next free record, or NULL when the log is
+ * not running or the ring is full (counted as dropped). Fill in the
+ * fields, then publish it with event_log_commit. */
+internal event_log_record *
+event_log_begin(event_log_type type)
+{
+    if (!__atomic_load_n(&event_log_state.running, __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+    event_log_ring *ring = event_log_thread_ring;
+    if (!ring && !(ring = event_log_attach()))
+    {
+        return NULL;
+    }
+
+    u32 head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= EVENT_LOG_RING_SIZE)
+    {
+        ++ring->dropped;
+        return NULL;
+    }
+
+    event_log_record *record = &ring->records[head & (EVENT_LOG_RING_SIZE - 1)];
+    record->timestamp_ns = clock_ns();
+    record->type = type;
+    record->thread = ring->index;
+    return record;
+}
+
+internal void
+event_log_commit(void)
+{
+    event_log_ring *ring = event_log_thread_ring;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+internal int
+event_log_compare(const void *a, const void *b)
+{
+    u64 x = ((event_log_record*)a)->timestamp_ns;
+    u64 y = ((event_log_record*)b)->timestamp_ns;
+    return x < y ? -1 : x > y;
+}
+
+/* Moves whatever the rings hold into the output, returns the record count */
+internal u32
+event_log_drain(void)
+{
+    u32 ring_count = __atomic_load_n(&event_log_state.ring_count, __ATOMIC_ACQUIRE);
+    u32 count = 0;
+    for (u32 i = 0; i < ring_count; ++i)
+    {
+        event_log_ring *ring = event_log_state.rings[i];
+        u32 tail = ring->tail;
+        u32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head && count < event_log_state.scratch_size)
+        {
+            event_log_state.scratch[count++] = ring->records[tail & (EVENT_LOG_RING_SIZE - 1)];
+            ++tail;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    /* Each ring is already in order, this interleaves the threads */
+    qsort(event_log_state.scratch, count, sizeof(event_log_record), event_log_compare);
+    if (event_log_state.file)
+    {
+        fwrite(event_log_state.scratch, sizeof(event_log_record), count, event_log_state.file);
+        fflush(event_log_state.file);
+    }
+    else
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            event_log_format(stdout, &event_log_state.scratch[i]);
+        }
+        fflush(stdout);
+    }
+    event_log_state.stats.written += count;
+    ++event_log_state.stats.flushes;
+    return count;
+}
+
+internal void *
+event_log_writer_main(void *data)
+{
+    timespec interval = {};
+    interval.tv_nsec = EVENT_LOG_FLUSH_INTERVAL_NS;
+    for (;;)
+    {
+        b8 quit = __atomic_load_n(&event_log_state.quit, __ATOMIC_ACQUIRE);
+        while (event_log_drain() == event_log_state.scratch_size)
+        {
+        }
+        if (quit)
+        {
+            return NULL;
+        }
+        nanosleep(&interval, NULL);
+    }
+}
+
+/* With a path the log is written raw for logdump, otherwise it is
+ * formatted to stdout */
+internal b8
+event_log_start(const char *path)
+{
+    pthread_mutex_init(&event_log_state.attach_mutex, NULL);
+    event_log_state.scratch_size = EVENT_LOG_RING_SIZE;
+    event_log_state.scratch = (event_log_record*)malloc(
+        event_log_state.scratch_size * sizeof(event_log_record));
+    if (!event_log_state.scratch)
+    {
+        return false;
+    }
+
+    if (path)
+    {
+        event_log_state.file = fopen(path, "wb");
+        if (!event_log_state.file)
+        {
+            free(event_log_state.scratch);
+            return false;
+        }
+        event_log_header header = {};
+        memcpy(header.magic, event_log_magic, sizeof(header.magic));
+        header.version = EVENT_LOG_VERSION;
+        header.record_size = sizeof(event_log_record);
+        fwrite(&header, sizeof(header), 1, event_log_state.file);
+    }
+
+    if (pthread_create(&event_log_state.writer, NULL, event_log_writer_main, NULL) != 0)
+    {
+        if (event_log_state.file)
+        {
+            fclose(event_log_state.file);
+        }
+        free(event_log_state.scratch);
+        return false;
+    }
+    __atomic_store_n(&event_log_state.running, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Call once every logging thread is done, the writer drains what is left */
+internal void
+event_log_stop(void)
+{
+    if (!event_log_state.running)
+    {
+        return;
+    }
+    __atomic_store_n(&event_log_state.running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&event_log_state.quit, true, __ATOMIC_RELEASE);
+    pthread_join(event_log_state.writer, NULL);
+
+    if (event_log_state.file)
+    {
+        fclose(event_log_state.file);
+        event_log_state.file = NULL;
+    }
+    free(event_log_state.scratch);
+
+    for (u32 i = 0; i < event_log_state.ring_count; ++i)
+    {
+        event_log_state.stats.dropped += event_log_state.rings[i]->dropped;
+        free(event_log_state.rings[i]);
+        event_log_state.rings[i] = NULL;
+    }
+    event_log_state.stats.threads = event_log_state.ring_count;
+    event_log_state.ring_count = 0;
+    pthread_mutex_destroy(&event_log_state.attach_mutex);
+}
+
+/* After event_log_stop */
+internal void
+event_log_print_stats(void)
+{
+    fprintf(stderr, "event log: %llu records in %llu flushes from %u threads, %llu dropped\n",
+        (unsigned long long)event_log_state.stats.written,
+        (unsigned long long)event_log_state.stats.flushes,
+        event_log_state.stats.threads,
+        (unsigned long long)event_log_state.stats.dropped
+    );
+}
@@ -0,0 +1,196 @@
+/* Layout of event log records and their text form. The client's writer
+ * and logdump both include this; logdump needs nothing else from the
+ * client to decode a raw log. */
+
+enum pointer_event_mask
+{
+    POINTER_EVENT_ENTER     = 1 << 0,
+    POINTER_EVENT_LEAVE     = 1 << 1,
+    POINTER_EVENT_MOTION    = 1 << 2,
+    POINTER_EVENT_BUTTON    = 1 << 3,
+    POINTER_EVENT_AXIS      = 1 << 4,
+    POINTER_EVENT_AXIS_SOURCE   = 1 << 5,
+    POINTER_EVENT_AXIS_STOP     = 1 << 6,
+    POINTER_EVENT_AXIS_DISCRETE = 1 << 7,
+};
+
+#define EVENT_LOG_FIELDS 12
+#define EVENT_LOG_VERSION 2
+
+global_variable const char event_log_magic[8] = { 'W', 'L', 'E', 'V', 'L', 'O', 'G', 0 };
+
+enum event_log_type
+{
+    /* time, event mask, x, y, button, button state, axis source,
+     * valid axes mask, then value and discrete for each axis */
+    EVENT_LOG_POINTER_FRAME,
+    EVENT_LOG_KEYBOARD_ENTER,
+    /* Like EVENT_LOG_KEY, one per key held on enter */
+    EVENT_LOG_KEYBOARD_ENTER_KEY,
+    EVENT_LOG_KEYBOARD_LEAVE,
+    /* time, key, state, keysym, then up to 12 bytes of UTF-8 */
+    EVENT_LOG_KEY,
+    /* Like EVENT_LOG_KEY, from the client's key repeat */
+    EVENT_LOG_KEY_REPEAT,
+    EVENT_LOG_TYPE_COUNT,
+};
+
+/* One cache line */
+struct event_log_record
+{
+    u64 timestamp_ns;
+    u32 type;
+    u32 thread;
+    u32 fields[EVENT_LOG_FIELDS];
+};
+
+/* Start of a raw log file, followed by records until EOF */
+struct event_log_header
+{
+    char magic[8];
+    u32 version;
+    u32 record_size;
+};
+
+global_variable const char *event_log_axis_name[2] =
+{
+    [WL_POINTER_AXIS_VERTICAL_SCROLL] = "vertical",
+    [WL_POINTER_AXIS_HORIZONTAL_SCROLL] = "horizontal",
+};
+
+global_variable const char *event_log_axis_source[4] =
+{
+    [WL_POINTER_AXIS_SOURCE_WHEEL] = "wheel",
+    [WL_POINTER_AXIS_SOURCE_FINGER] = "finger",
+    [WL_POINTER_AXIS_SOURCE_CONTINUOUS] = "continuous",
+    [WL_POINTER_AXIS_SOURCE_WHEEL_TILT] = "wheel tilt",
+};
+
+/// FORMATTING
+
+internal void
+event_log_format_key(FILE *out, event_log_record *record)
+{
+    char name[64];
+    xkb_keysym_t sym = record->fields[3];
+    xkb_keysym_get_name(sym, name, sizeof(name));
+    fprintf(out, "sym: %-12s (%d) utf8: '%.*s'\n", name, sym,
+        (int)strnlen((const char*)&record->fields[4], 3 * sizeof(u32)),
+        (const char*)&record->fields[4]);
+}
+
+internal void
+event_log_format_pointer_frame(FILE *out, event_log_record *record)
+{
+    u32 *fields = record->fields;
+    u32 mask = fields[1];
+    fprintf(out, "pointer frame @ %u :", fields[0]);
+
+    if (mask & POINTER_EVENT_ENTER)
+    {
+        fprintf(out, "entered %f, %f",
+            wl_fixed_to_double((wl_fixed_t)fields[2]),
+            wl_fixed_to_double((wl_fixed_t)fields[3])
+        );
+    }
+    if (mask & POINTER_EVENT_LEAVE)
+    {
+        fprintf(out, "leave");
+    }
+    if (mask & POINTER_EVENT_MOTION)
+    {
+        fprintf(out, "motion %f, %f",
+            wl_fixed_to_double((wl_fixed_t)fields[2]),
+            wl_fixed_to_double((wl_fixed_t)fields[3])
+        );
+    }
+    if (mask & POINTER_EVENT_BUTTON)
+    {
+        fprintf(out, "button %u %s", fields[4],
+            fields[5] == WL_POINTER_BUTTON_STATE_RELEASED ? "released" : "pressed");
+    }
+
+    u32 axis_events =
+        POINTER_EVENT_AXIS |
+        POINTER_EVENT_AXIS_STOP |
+        POINTER_EVENT_AXIS_DISCRETE;
+
+    if (mask & axis_events)
+    {
+        for (u8 i = 0; i < 2; ++i)
+        {
+            if (!(fields[7] & (1 << i)))
+            {
+                continue;
+            }
+            fprintf(out, "%s axis ", event_log_axis_name[i]);
+            if (mask & POINTER_EVENT_AXIS)
+            {
+                fprintf(out, "value %f ", wl_fixed_to_double((wl_fixed_t)fields[8 + 2*i]));
+            }
+            if (mask & POINTER_EVENT_AXIS_DISCRETE)
+            {
+                fprintf(out, "discrete %d ", (s32)fields[9 + 2*i]);
+            }
+            if ((mask & POINTER_EVENT_AXIS_SOURCE) && fields[6] < 4)
+            {
+                fprintf(out, "via %s ", event_log_axis_source[fields[6]]);
+            }
+            if (mask & POINTER_EVENT_AXIS_STOP)
+            {
+                fprintf(out, "stopped");
+            }
+        }
+    }
+    fprintf(out, " END FRAME\n");
+}
+
+internal void
+event_log_format(FILE *out, event_log_record *record)
+{
+    fprintf(out, "[%llu.%06llu] ",
+        (unsigned long long)(record->timestamp_ns / 1000000000ull),
+        (unsigned long long)(record->timestamp_ns % 1000000000ull / 1000));
+
+    switch (record->type)
+    {
+        case EVENT_LOG_POINTER_FRAME:
+        {
+            event_log_format_pointer_frame(out, record);
+        } break;
+
+        case EVENT_LOG_KEYBOARD_ENTER:
+        {
+            fprintf(out, "keyboard enter; keys pressed are:\n");
+        } break;
+
+        case EVENT_LOG_KEYBOARD_ENTER_KEY:
+        {
+            fprintf(out, "  ");
+            event_log_format_key(out, record);
+        } break;
+
+        case EVENT_LOG_KEYBOARD_LEAVE:
+        {
+            fprintf(out, "keyboard leave\n");
+        } break;
+
+        case EVENT_LOG_KEY:
+        {
+            fprintf(out, "key %s: ",
+                record->fields[2] == WL_KEYBOARD_KEY_STATE_PRESSED ? "press" : "release");
+            event_log_format_key(out, record);
+        } break;
+
+        case EVENT_LOG_KEY_REPEAT:
+        {
+            fprintf(out, "key repeat: ");
+            event_log_format_key(out, record);
+        } break;
+
+        default:
+        {
+            fprintf(out, "unknown record type %u\n", record->type);
+        } break;
+    }
+}
@@ -0,0 +1,410 @@
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define EVENT_LOOP_MAX_SOURCES 32
+#define EVENT_LOOP_MAX_EVENTS 16
+
+/* `events` is the EPOLL* mask that fired */
+typedef void event_fd_fn(void *data, int fd, u32 events);
+/* `count` is the number of timer expirations or the summed eventfd writes
+ * since the last call */
+typedef void event_count_fn(void *data, u64 count);
+typedef void event_idle_fn(void *data);
+
+enum event_source_type
+{
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_EVENT,
+};
+
+struct event_source
+{
+    event_source_type type;
+    int fd;
+    event_fd_fn *fd_fn;
+    event_count_fn *count_fn;
+    void *data;
+    b8 used;
+    /* Removed during a dispatch, the slot is recycled once it finishes */
+    b8 removed;
+};
+
+struct event_loop_stats
+{
+    u64 iterations;
+    u64 display_reads;
+    u64 flush_blocked;
+    u64 idle_runs;
+    u64 idle_deadline_runs;
+};
+
+/* Single-threaded loop over the Wayland display fd and any number of fd,
+ * timerfd and eventfd sources. The display is read with the
+ * prepare_read/read_events protocol so that queued events are never
+ * dispatched behind our back, and flushes that hit EAGAIN are finished
+ * once the socket is writable again. */
+struct event_loop
+{
+    int epoll_fd;
+    wl_display *wl_display;
+    int display_fd;
+    b8 display_wants_write;
+
+    event_source sources[EVENT_LOOP_MAX_SOURCES];
+
+    event_idle_fn *idle_fn;
+    void *idle_data;
+    u64 idle_deadline_ns;
+
+    event_loop_stats stats;
+};
+
+/* The display fd is registered with a NULL data pointer */
+internal b8
+event_loop_init(event_loop *loop, wl_display *wl_display)
+{
+    *loop = {};
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd == -1)
+    {
+        return false;
+    }
+
+    loop->wl_display = wl_display;
+    loop->display_fd = wl_display_get_fd(wl_display);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->display_fd, &event) == -1)
+    {
+        close(loop->epoll_fd);
+        return false;
+    }
+    return true;
+}
+
+internal event_source *
+event_loop_add_source(event_loop *loop, event_source_type type, int fd, u32 events, void *data)
+{
+    event_source *source = NULL;
+    for (u32 i = 0; i < EVENT_LOOP_MAX_SOURCES; ++i)
+    {
+        if (!loop->sources[i].used)
+        {
+            source = &loop->sources[i];
+            break;
+        }
+    }
+    if (!source)
+    {
+        return NULL;
+    }
+
+    epoll_event event = {};
+    event.events = events;
+    event.data.ptr = source;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        return NULL;
+    }
+
+    *source = {};
+    source->type = type;
+    source->fd = fd;
+    source->data = data;
+    source->used = true;
+    return source;
+}
+
+/* The caller keeps ownership of `fd` */
+internal event_source *
+event_loop_add_fd(event_loop *loop, int fd, u32 events, event_fd_fn *fn, void *data)
+{
+    event_source *source = event_loop_add_source(loop, EVENT_SOURCE_FD, fd, events, data);
+    if (source)
+    {
+        source->fd_fn = fn;
+    }
+    return source;
+}
+
+/* Creates a disarmed timer, see event_loop_timer_arm */
+internal event_source *
+event_loop_add_timer(event_loop *loop, event_count_fn *fn, void *data)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    event_source *source = event_loop_add_source(loop, EVENT_SOURCE_TIMER, fd, EPOLLIN, data);
+    if (!source)
+    {
+        close(fd);
+        return NULL;
+    }
+    source->count_fn = fn;
+    return source;
+}
+
+/* Fires `delay_ns` from now and then every `interval_ns`, or only once
+ * when the interval is 0. A delay of 0 disarms the timer. */
+internal void
+event_loop_timer_arm(event_source *source, u64 delay_ns, u64 interval_ns)
+{
+    itimerspec spec = {};
+    spec.it_value.tv_sec = delay_ns / 1000000000ull;
+    spec.it_value.tv_nsec = delay_ns % 1000000000ull;
+    spec.it_interval.tv_sec = interval_ns / 1000000000ull;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000ull;
+    timerfd_settime(source->fd, 0, &spec, NULL);
+}
+
+/* An eventfd other threads can wake the loop with, see event_loop_signal */
+internal event_source *
+event_loop_add_event(event_loop *loop, event_count_fn *fn, void *data)
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    event_source *source = event_loop_add_source(loop, EVENT_SOURCE_EVENT, fd, EPOLLIN, data);
+    if (!source)
+    {
+        close(fd);
+        return NULL;
+    }
+    source->count_fn = fn;
+    return source;
+}
+
+/* Safe to call from any thread */
+internal void
+event_loop_signal(event_source *source)
+{
+    u64 one = 1;
+    while (write(source->fd, &one, sizeof(one)) == -1 && errno == EINTR)
+    {
+    }
+}
+
+internal void
+event_loop_remove(event_loop *loop, event_source *source)
+{
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    if (source->type != EVENT_SOURCE_FD)
+    {
+        close(source->fd);
+    }
+    source->fd = -1;
+    source->removed = true;
+}
+
+/* Runs `fn` once, as soon as an iteration finds nothing else to do, or at
+ * the deadline even if events keep arriving. Replaces any pending idle
+ * callback. */
+internal void
+event_loop_set_idle(event_loop *loop, event_idle_fn *fn, void *data, u64 deadline_ns)
+{
+    loop->idle_fn = fn;
+    loop->idle_data = data;
+    loop->idle_deadline_ns = clock_ns() + deadline_ns;
+}
+
+internal void
+event_loop_display_interest(event_loop *loop, b8 want_write)
+{
+    if (loop->display_wants_write == want_write)
+    {
+        return;
+    }
+    epoll_event event = {};
+    event.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, loop->display_fd, &event);
+    loop->display_wants_write = want_write;
+}
+
+/* Returns false on a fatal display error */
+internal b8
+event_loop_flush(event_loop *loop)
+{
+    if (wl_display_flush(loop->wl_display) == -1)
+    {
+        if (errno != EAGAIN)
+        {
+            return false;
+        }
+        ++loop->stats.flush_blocked;
+        event_loop_display_interest(loop, true);
+        return true;
+    }
+    event_loop_display_interest(loop, false);
+    return true;
+}
+
+internal void
+event_loop_run_source(event_source *source, u32 events)
+{
+    if (source->type == EVENT_SOURCE_FD)
+    {
+        source->fd_fn(source->data, source->fd, events);
+        return;
+    }
+
+    u64 count = 0;
+    if (read(source->fd, &count, sizeof(count)) == sizeof(count) && count > 0)
+    {
+        source->count_fn(source->data, count);
+    }
+}
+
+/* One iteration: dispatches what is queued, flushes, waits for any source
+ * and runs what fired. Returns -1 once the display connection fails. */
+internal int
+event_loop_dispatch(event_loop *loop)
+{
+    ++loop->stats.iterations;
+    wl_display *display = loop->wl_display;
+
+    while (wl_display_prepare_read(display) != 0)
+    {
+        if (wl_display_dispatch_pending(display) == -1)
+        {
+            return -1;
+        }
+    }
+    if (!event_loop_flush(loop))
+    {
+        wl_display_cancel_read(display);
+        return -1;
+    }
+
+    int timeout = -1;
+    if (loop->idle_fn)
+    {
+        timeout = 0;
+    }
+
+    epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int count = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+    if (count == -1)
+    {
+        wl_display_cancel_read(display);
+        /* A signal, e.g. SIGUSR1 for the frame trace */
+        return errno == EINTR ? 0 : -1;
+    }
+
+    /* Finish the read before any callback can make requests or roundtrips */
+    b8 display_readable = false;
+    for (int i = 0; i < count; ++i)
+    {
+        if (events[i].data.ptr == NULL)
+        {
+            /* A compositor that posts a protocol error closes the socket
+             * right after, so the error is read and dispatched first for
+             * wl_display_get_error to report it */
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                if (events[i].events & EPOLLIN)
+                {
+                    if (wl_display_read_events(display) == 0)
+                    {
+                        wl_display_dispatch_pending(display);
+                    }
+                }
+                else
+                {
+                    wl_display_cancel_read(display);
+                }
+                return -1;
+            }
+            display_readable = (events[i].events & EPOLLIN) != 0;
+            if ((events[i].events & EPOLLOUT) && !event_loop_flush(loop))
+            {
+                wl_display_cancel_read(display);
+                return -1;
+            }
+        }
+    }
+    if (display_readable)
+    {
+        ++loop->stats.display_reads;
+        if (wl_display_read_events(display) == -1)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        wl_display_cancel_read(display);
+    }
+    if (wl_display_dispatch_pending(display) == -1)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        event_source *source = (event_source*)events[i].data.ptr;
+        if (source && !source->removed)
+        {
+            event_loop_run_source(source, events[i].events);
+        }
+    }
+    for (u32 i = 0; i < EVENT_LOOP_MAX_SOURCES; ++i)
+    {
+        if (loop->sources[i].removed)
+        {
+            loop->sources[i] = {};
+        }
+    }
+
+    if (loop->idle_fn)
+    {
+        b8 idle = count == 0;
+        if (idle || clock_ns() >= loop->idle_deadline_ns)
+        {
+            event_idle_fn *fn = loop->idle_fn;
+            loop->idle_fn = NULL;
+            ++loop->stats.idle_runs;
+            if (!idle)
+            {
+                ++loop->stats.idle_deadline_runs;
+            }
+            fn(loop->idle_data);
+        }
+    }
+    return 0;
+}
+
+internal void
+event_loop_destroy(event_loop *loop)
+{
+    for (u32 i = 0; i < EVENT_LOOP_MAX_SOURCES; ++i)
+    {
+        if (loop->sources[i].used && !loop->sources[i].removed)
+        {
+            event_loop_remove(loop, &loop->sources[i]);
+        }
+    }
+    close(loop->epoll_fd);
+}
+
+internal void
+event_loop_print_stats(event_loop *loop)
+{
+    fprintf(stderr, "event loop: %llu iterations, %llu display reads, "
+        "%llu blocked flushes, %llu idle runs (%llu at deadline)\n",
+        (unsigned long long)loop->stats.iterations,
+        (unsigned long long)loop->stats.display_reads,
+        (unsigned long long)loop->stats.flush_blocked,
+        (unsigned long long)loop->stats.idle_runs,
+        (unsigned long long)loop->stats.idle_deadline_runs
+    );
+}
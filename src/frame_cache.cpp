@@ -0,0 +1,198 @@
+/* The animation only has 8 distinct frames per size */
+#define FRAME_CACHE_PHASES 8
+#define FRAME_CACHE_DEFAULT_CAP_MB 128
+
+struct cached_frame
+{
+    wl_buffer *wl_buffer;
+    u8 *data;
+    b8 rendered;
+    /* Attached and not yet released by the compositor */
+    b8 held;
+};
+
+struct frame_cache_stats
+{
+    u64 hits;
+    u64 renders;
+    u64 invalidations;
+    /* Frames still held at an invalidation, destroyed on release */
+    u64 deferred_destroys;
+    u64 over_cap;
+};
+
+/* Keeps every phase of the animation for the current size as its own
+ * wl_buffer, all carved out of a single shm pool. Cached frames are never
+ * written again once rendered, so they can be attached while the
+ * compositor still holds them. Only destroying one has to wait for its
+ * release. */
+struct frame_cache
+{
+    wl_shm *wl_shm;
+    pixel_format format;
+    size_t memory_cap;
+    s32 width;
+    s32 height;
+    s32 stride;
+    void *data;
+    size_t size;
+    cached_frame frames[FRAME_CACHE_PHASES];
+    frame_cache_stats stats;
+};
+
+internal void
+cached_frame_release(void *data, wl_buffer *wl_buffer)
+{
+    cached_frame *frame = (cached_frame*)data;
+    if (frame)
+    {
+        frame->held = false;
+    }
+    else
+    {
+        wl_buffer_destroy(wl_buffer);
+    }
+}
+
+global_variable wl_buffer_listener cached_frame_listener = {
+    .release = cached_frame_release,
+};
+
+internal void
+frame_cache_init(frame_cache *cache, wl_shm *wl_shm, pixel_format format, size_t memory_cap)
+{
+    *cache = {};
+    cache->wl_shm = wl_shm;
+    cache->format = format;
+    cache->memory_cap = memory_cap;
+}
+
+internal void
+frame_cache_invalidate(frame_cache *cache)
+{
+    if (!cache->data)
+    {
+        return;
+    }
+
+    /* A frame the compositor still shows must outlive this, or the surface
+     * contents are undefined until the next commit. It is orphaned instead
+     * and destroyed by its release. The compositor keeps its own mapping
+     * of the pool, so the storage can still be unmapped here. */
+    for (u32 i = 0; i < FRAME_CACHE_PHASES; ++i)
+    {
+        cached_frame *frame = &cache->frames[i];
+        if (frame->held)
+        {
+            wl_buffer_set_user_data(frame->wl_buffer, NULL);
+            ++cache->stats.deferred_destroys;
+        }
+        else
+        {
+            wl_buffer_destroy(frame->wl_buffer);
+        }
+        *frame = {};
+    }
+    munmap(cache->data, cache->size);
+    cache->data = NULL;
+    cache->size = 0;
+    cache->width = 0;
+    cache->height = 0;
+    ++cache->stats.invalidations;
+}
+
+internal b8
+frame_cache_allocate(frame_cache *cache, s32 width, s32 height)
+{
+    s32 stride = width * pixel_format_bytes(cache->format);
+    size_t frame_size = (size_t)stride * height;
+    size_t size = frame_size * FRAME_CACHE_PHASES;
+    if (size > cache->memory_cap || size > INT32_MAX)
+    {
+        ++cache->stats.over_cap;
+        return false;
+    }
+
+    int fd = allocate_shm_file(size);
+    if (fd == -1)
+    {
+        return false;
+    }
+    TRACE_FRAME_STAGE(FRAME_STAGE_ALLOC);
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    TRACE_FRAME_STAGE(FRAME_STAGE_MAP);
+
+    wl_shm_pool *shm_pool = wl_shm_create_pool(cache->wl_shm, fd, size);
+    for (u32 i = 0; i < FRAME_CACHE_PHASES; ++i)
+    {
+        cached_frame *frame = &cache->frames[i];
+        frame->wl_buffer = wl_shm_pool_create_buffer(
+            shm_pool,
+            i * frame_size,
+            width,
+            height,
+            stride,
+            pixel_formats[cache->format].wl_format
+        );
+        wl_buffer_add_listener(frame->wl_buffer, &cached_frame_listener, frame);
+        frame->data = (u8*)data + i * frame_size;
+        frame->rendered = false;
+        frame->held = false;
+    }
+    wl_shm_pool_destroy(shm_pool);
+    close(fd);
+    TRACE_FRAME_STAGE(FRAME_STAGE_BUFFER);
+
+    cache->data = data;
+    cache->size = size;
+    cache->width = width;
+    cache->height = height;
+    cache->stride = stride;
+    return true;
+}
+
+/* Returns the frame for `phase` at the given size, allocating storage for
+ * all phases on first use. The caller renders it if `rendered` is false.
+ * Returns NULL when the phases would not fit under the memory cap. */
+internal cached_frame *
+frame_cache_lookup(frame_cache *cache, s32 width, s32 height, s32 phase)
+{
+    if (cache->data && (cache->width != width || cache->height != height))
+    {
+        frame_cache_invalidate(cache);
+    }
+    if (!cache->data && !frame_cache_allocate(cache, width, height))
+    {
+        return NULL;
+    }
+
+    cached_frame *frame = &cache->frames[phase % FRAME_CACHE_PHASES];
+    if (frame->rendered)
+    {
+        ++cache->stats.hits;
+    }
+    else
+    {
+        ++cache->stats.renders;
+    }
+    return frame;
+}
+
+internal void
+frame_cache_print_stats(frame_cache *cache)
+{
+    fprintf(stderr, "frame cache: %llu hits, %llu renders, %llu invalidations "
+        "(%llu frames destroyed on release), %llu over cap\n",
+        (unsigned long long)cache->stats.hits,
+        (unsigned long long)cache->stats.renders,
+        (unsigned long long)cache->stats.invalidations,
+        (unsigned long long)cache->stats.deferred_destroys,
+        (unsigned long long)cache->stats.over_cap
+    );
+}
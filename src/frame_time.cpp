@@ -0,0 +1,43 @@
+/* CPU time spent producing each frame, from the start of submit_frame to
+ * the flush. Always on, unlike the per-stage trace, so that optimized
+ * builds can be compared on the same numbers; the "frame time:" line is
+ * what scripts/compare_profiles.sh reads. */
+
+/* Power of two */
+#define FRAME_TIME_SAMPLES 4096
+
+struct frame_time_stats
+{
+    u64 frames;
+    u64 total_ns;
+    u64 samples[FRAME_TIME_SAMPLES];
+};
+
+internal void
+frame_time_record(frame_time_stats *stats, u64 duration_ns)
+{
+    stats->samples[stats->frames++ & (FRAME_TIME_SAMPLES - 1)] = duration_ns;
+    stats->total_ns += duration_ns;
+}
+
+internal void
+frame_time_print_stats(frame_time_stats *stats)
+{
+    if (stats->frames == 0)
+    {
+        return;
+    }
+    u64 count = stats->frames < FRAME_TIME_SAMPLES ? stats->frames : FRAME_TIME_SAMPLES;
+    local_persist u64 sorted[FRAME_TIME_SAMPLES];
+    memcpy(sorted, stats->samples, count * sizeof(sorted[0]));
+    qsort(sorted, count, sizeof(sorted[0]), compare_u64);
+
+    fprintf(stderr, "frame time: %llu frames, mean %.1f us, median %.1f us, "
+        "p99 %.1f us, max %.1f us\n",
+        (unsigned long long)stats->frames,
+        (f64)stats->total_ns / stats->frames / 1e3,
+        sorted[count / 2] / 1e3,
+        sorted[(count - 1) * 99 / 100] / 1e3,
+        sorted[count - 1] / 1e3
+    );
+}
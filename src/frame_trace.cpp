@@ -0,0 +1,215 @@
+/* Per-stage frame timings. Build with FRAME_TRACE defined (make TRACE=1) to
+ * record them; otherwise every TRACE_FRAME_* macro expands to nothing.
+ *
+ * Each frame gets one record in a ring holding the CLOCK_MONOTONIC_RAW
+ * time at which each stage finished. A stage's duration is the gap to
+ * the previous stage that ran, so stages a frame skips cost nothing.
+ * The ring is dumped to stderr on SIGUSR1 and at exit. */
+
+enum frame_stage
+{
+    FRAME_STAGE_BEGIN,
+    /* Only present in frames that had to create a buffer */
+    FRAME_STAGE_ALLOC,
+    FRAME_STAGE_MAP,
+    FRAME_STAGE_BUFFER,
+    FRAME_STAGE_RASTER,
+    FRAME_STAGE_ATTACH,
+    FRAME_STAGE_COMMIT,
+    FRAME_STAGE_FLUSH,
+    FRAME_STAGE_COUNT,
+};
+
+#if FRAME_TRACE
+
+#include <signal.h>
+#include <time.h>
+
+/* Power of two */
+#define FRAME_TRACE_RING_SIZE 256
+
+global_variable const char *frame_stage_names[FRAME_STAGE_COUNT] =
+{
+    "begin", "alloc", "map", "buffer", "raster", "attach", "commit", "flush",
+};
+
+/* `sequence` is odd while the record is being written, so a reader on any
+ * thread can tell a torn copy from a finished one without taking a lock */
+struct frame_trace_record
+{
+    u32 sequence;
+    u64 frame;
+    u64 stamps[FRAME_STAGE_COUNT];
+};
+
+struct frame_trace
+{
+    frame_trace_record records[FRAME_TRACE_RING_SIZE];
+    u64 frame_count;
+    frame_trace_record *current;
+};
+
+global_variable frame_trace frame_trace_state;
+global_variable volatile sig_atomic_t frame_trace_dump_requested;
+
+internal u64
+frame_trace_clock(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+internal void
+frame_trace_handle_signal(int signal_number)
+{
+    frame_trace_dump_requested = 1;
+}
+
+internal void
+frame_trace_init(void)
+{
+    struct sigaction action = {};
+    action.sa_handler = frame_trace_handle_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+internal void
+frame_trace_end(void)
+{
+    frame_trace_record *record = frame_trace_state.current;
+    if (record)
+    {
+        __atomic_store_n(&record->sequence, record->sequence + 1, __ATOMIC_RELEASE);
+        frame_trace_state.current = NULL;
+    }
+}
+
+internal void
+frame_trace_begin(void)
+{
+    frame_trace_end();
+
+    u64 frame = frame_trace_state.frame_count++;
+    frame_trace_record *record = &frame_trace_state.records[frame & (FRAME_TRACE_RING_SIZE - 1)];
+    __atomic_store_n(&record->sequence, record->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->frame = frame;
+    for (u32 i = 0; i < FRAME_STAGE_COUNT; ++i)
+    {
+        record->stamps[i] = 0;
+    }
+    record->stamps[FRAME_STAGE_BEGIN] = frame_trace_clock();
+    frame_trace_state.current = record;
+}
+
+internal void
+frame_trace_stage(frame_stage stage)
+{
+    if (frame_trace_state.current)
+    {
+        frame_trace_state.current->stamps[stage] = frame_trace_clock();
+    }
+}
+
+/* Copies a finished record, returns false if it was being rewritten */
+internal b8
+frame_trace_read(frame_trace_record *record, frame_trace_record *copy)
+{
+    u32 before = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+    if (before & 1)
+    {
+        return false;
+    }
+    *copy = *record;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&record->sequence, __ATOMIC_RELAXED) == before;
+}
+
+internal void
+frame_trace_dump(void)
+{
+    u64 sums[FRAME_STAGE_COUNT] = {};
+    u64 maxima[FRAME_STAGE_COUNT] = {};
+    u64 counts[FRAME_STAGE_COUNT] = {};
+
+    u64 frame_count = frame_trace_state.frame_count;
+    u64 first = frame_count > FRAME_TRACE_RING_SIZE ? frame_count - FRAME_TRACE_RING_SIZE : 0;
+    fprintf(stderr, "frame trace: frames %llu-%llu, stage times in us\n",
+        (unsigned long long)first, (unsigned long long)(frame_count ? frame_count - 1 : 0));
+
+    for (u64 i = first; i < frame_count; ++i)
+    {
+        frame_trace_record record;
+        if (!frame_trace_read(&frame_trace_state.records[i & (FRAME_TRACE_RING_SIZE - 1)], &record) ||
+            record.frame != i)
+        {
+            continue;
+        }
+
+        fprintf(stderr, "  frame %llu:", (unsigned long long)record.frame);
+        u64 previous = record.stamps[FRAME_STAGE_BEGIN];
+        for (u32 stage = FRAME_STAGE_BEGIN + 1; stage < FRAME_STAGE_COUNT; ++stage)
+        {
+            if (!record.stamps[stage])
+            {
+                continue;
+            }
+            u64 duration = record.stamps[stage] - previous;
+            previous = record.stamps[stage];
+            sums[stage] += duration;
+            ++counts[stage];
+            if (duration > maxima[stage])
+            {
+                maxima[stage] = duration;
+            }
+            fprintf(stderr, " %s %.1f", frame_stage_names[stage], duration / 1e3);
+        }
+        fprintf(stderr, " total %.1f\n", (previous - record.stamps[FRAME_STAGE_BEGIN]) / 1e3);
+    }
+
+    for (u32 stage = FRAME_STAGE_BEGIN + 1; stage < FRAME_STAGE_COUNT; ++stage)
+    {
+        if (counts[stage])
+        {
+            fprintf(stderr, "frame trace: %-6s %4llu frames, mean %.1f us, max %.1f us\n",
+                frame_stage_names[stage],
+                (unsigned long long)counts[stage],
+                (f64)sums[stage] / counts[stage] / 1e3,
+                maxima[stage] / 1e3
+            );
+        }
+    }
+}
+
+/* Called from the event loop, outside the signal handler */
+internal void
+frame_trace_poll(void)
+{
+    if (frame_trace_dump_requested)
+    {
+        frame_trace_dump_requested = 0;
+        frame_trace_dump();
+    }
+}
+
+#define TRACE_FRAME_INIT() frame_trace_init()
+#define TRACE_FRAME_BEGIN() frame_trace_begin()
+#define TRACE_FRAME_STAGE(stage) frame_trace_stage(stage)
+#define TRACE_FRAME_END() frame_trace_end()
+#define TRACE_FRAME_POLL() frame_trace_poll()
+#define TRACE_FRAME_DUMP() frame_trace_dump()
+
+#else
+
+#define TRACE_FRAME_INIT()
+#define TRACE_FRAME_BEGIN()
+#define TRACE_FRAME_STAGE(stage)
+#define TRACE_FRAME_END()
+#define TRACE_FRAME_POLL()
+#define TRACE_FRAME_DUMP()
+
+#endif
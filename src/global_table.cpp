@@ -0,0 +1,155 @@
+/* Interface name to binder lookup for wl_registry.global, built at
+ * compile time. The bindings are hashed into a power-of-two slot array
+ * with the first seed that gives every name its own slot, so a lookup is
+ * one hash of the advertised name and one strcmp against the only
+ * candidate. Adding a protocol is one more entry in the bindings array.
+ *
+ *     global_variable constexpr global_binding bindings[] = { ... };
+ *     global_variable constexpr auto globals = global_table_build(bindings);
+ */
+
+/* `version` is already clamped to the binding's version range */
+typedef void global_bind_fn(void *data, wl_registry *registry, u32 name, u32 version);
+
+struct global_binding
+{
+    /* Must match interface->name, see global_table_check */
+    const char *name;
+    const wl_interface *interface;
+    /* Oldest version the code using the global works with; older ones are
+     * not bound at all */
+    u32 min_version;
+    /* Newest version the listeners are written against */
+    u32 max_version;
+    global_bind_fn *bind;
+};
+
+/* Seeded FNV-1a. The low bits of a product only depend on the low bits
+ * of its operands, so the slot bits are mixed with the high ones before
+ * they are masked off. */
+constexpr u32
+global_hash(const char *name, u32 seed)
+{
+    u32 hash = 2166136261u ^ seed;
+    for (; *name; ++name)
+    {
+        hash ^= (u8)*name;
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+constexpr u32
+global_table_size(u32 count)
+{
+    u32 size = 1;
+    while (size < count * 2)
+    {
+        size *= 2;
+    }
+    return size;
+}
+
+#define GLOBAL_TABLE_MAX_SEED 65536
+
+template <u32 count>
+struct global_table
+{
+    static constexpr u32 size = global_table_size(count);
+    u32 seed;
+    /* Binding index + 1, 0 for an empty slot */
+    u8 slots[size];
+    global_binding bindings[count];
+};
+
+template <u32 count>
+constexpr global_table<count>
+global_table_build(const global_binding (&bindings)[count])
+{
+    static_assert(count < 255, "slots hold a u8 index");
+    global_table<count> table = {};
+    for (u32 i = 0; i < count; ++i)
+    {
+        table.bindings[i] = bindings[i];
+    }
+
+    for (u32 seed = 0; seed < GLOBAL_TABLE_MAX_SEED; ++seed)
+    {
+        for (u32 slot = 0; slot < table.size; ++slot)
+        {
+            table.slots[slot] = 0;
+        }
+        b8 collision = false;
+        for (u32 i = 0; i < count && !collision; ++i)
+        {
+            u32 slot = global_hash(bindings[i].name, seed) & (table.size - 1);
+            collision = table.slots[slot] != 0;
+            table.slots[slot] = (u8)(i + 1);
+        }
+        if (!collision)
+        {
+            table.seed = seed;
+            return table;
+        }
+    }
+    /* Not a constant expression, so a table without a seed fails to build */
+    throw "no collision-free seed";
+}
+
+template <u32 count>
+internal const global_binding *
+global_table_find(const global_table<count> *table, const char *interface)
+{
+    u32 slot = global_hash(interface, table->seed) & (table->size - 1);
+    u32 index = table->slots[slot];
+    if (index == 0)
+    {
+        return NULL;
+    }
+    const global_binding *binding = &table->bindings[index - 1];
+    return strcmp(binding->name, interface) == 0 ? binding : NULL;
+}
+
+/* Interface names are not constant expressions, so the literals the table
+ * was hashed from are checked against them once at startup */
+template <u32 count>
+internal b8
+global_table_check(const global_table<count> *table)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (strcmp(table->bindings[i].name, table->bindings[i].interface->name) != 0)
+        {
+            fprintf(stderr, "global table: %s is bound as %s\n",
+                table->bindings[i].name, table->bindings[i].interface->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Binds the global if the table has it and the compositor's version is
+ * recent enough, returns false if the table does not have it */
+template <u32 count>
+internal b8
+global_table_dispatch(const global_table<count> *table, void *data, wl_registry *registry,
+    u32 name, const char *interface, u32 version)
+{
+    const global_binding *binding = global_table_find(table, interface);
+    if (!binding)
+    {
+        return false;
+    }
+    if (version < binding->min_version)
+    {
+        fprintf(stderr, "global table: %s version %u is older than the %u required, "
+            "not bound\n", interface, version, binding->min_version);
+        return true;
+    }
+    binding->bind(data, registry, name,
+        version < binding->max_version ? version : binding->max_version);
+    return true;
+}
@@ -0,0 +1,220 @@
+#include <pthread.h>
+#include <semaphore.h>
+
+/* Power of two */
+#define INPUT_QUEUE_SIZE 1024
+/* Events handed to the consumer per call */
+#define INPUT_QUEUE_BATCH 64
+
+struct pointer_event
+{
+    /* pointer_event_mask bits */
+    u32 event_mask;
+    wl_fixed_t surface_x;
+    wl_fixed_t surface_y;
+    u32 button;
+    u32 state;
+    u32 time;
+    u32 serial;
+    struct
+    {
+        b8 valid;
+        wl_fixed_t value;
+        s32 discrete;
+    } axes[2];
+    u32 axis_source;
+};
+
+enum input_event_type
+{
+    /* A whole wl_pointer.frame worth of accumulated pointer state */
+    INPUT_EVENT_POINTER_FRAME,
+    /* The mapped keymap text, the consumer compiles and unmaps it */
+    INPUT_EVENT_KEYMAP,
+    INPUT_EVENT_KEYBOARD_ENTER,
+    /* One per key already held when the keyboard entered */
+    INPUT_EVENT_KEYBOARD_ENTER_KEY,
+    INPUT_EVENT_KEYBOARD_LEAVE,
+    INPUT_EVENT_KEY,
+    /* Generated by the client's key repeat, not the compositor */
+    INPUT_EVENT_KEY_REPEAT,
+    INPUT_EVENT_MODIFIERS,
+};
+
+struct input_event
+{
+    input_event_type type;
+    union
+    {
+        pointer_event pointer;
+        struct
+        {
+            u8 *text;
+            u32 size;
+        } keymap;
+        struct
+        {
+            u32 time;
+            u32 key;
+            u32 state;
+        } key;
+        struct
+        {
+            u32 depressed;
+            u32 latched;
+            u32 locked;
+            u32 group;
+        } modifiers;
+    };
+};
+
+typedef void input_batch_fn(void *data, input_event *events, u32 count);
+
+struct input_queue_stats
+{
+    u64 pushed;
+    u64 overflows;
+    u64 batches;
+    u32 high_water;
+};
+
+/* Single producer (the dispatch thread), single consumer (the queue's own
+ * thread). Head and tail live on separate cache lines and are the only
+ * shared state, so pushing never blocks or takes a lock. A full queue
+ * drops the event and counts an overflow instead of stalling dispatch. */
+struct input_queue
+{
+    alignas(64) u32 head;
+    alignas(64) u32 tail;
+    alignas(64) s32 consumer_sleeping;
+    b8 quit;
+    sem_t wake;
+    pthread_t thread;
+    input_batch_fn *fn;
+    void *data;
+
+    input_queue_stats stats;
+    input_event events[INPUT_QUEUE_SIZE];
+};
+
+internal void *
+input_queue_consumer_main(void *data)
+{
+    input_queue *queue = (input_queue*)data;
+    input_event batch[INPUT_QUEUE_BATCH];
+
+    for (;;)
+    {
+        u32 tail = queue->tail;
+        u32 head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            if (__atomic_load_n(&queue->quit, __ATOMIC_ACQUIRE))
+            {
+                return NULL;
+            }
+
+            /* Announce the sleep, then look again so a push that raced
+             * with the check above is not missed */
+            __atomic_store_n(&queue->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&queue->head, __ATOMIC_SEQ_CST) == tail &&
+                !__atomic_load_n(&queue->quit, __ATOMIC_SEQ_CST))
+            {
+                while (sem_wait(&queue->wake) == -1 && errno == EINTR)
+                {
+                }
+            }
+            __atomic_store_n(&queue->consumer_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        u32 count = head - tail;
+        if (count > INPUT_QUEUE_BATCH)
+        {
+            count = INPUT_QUEUE_BATCH;
+        }
+        for (u32 i = 0; i < count; ++i)
+        {
+            batch[i] = queue->events[(tail + i) & (INPUT_QUEUE_SIZE - 1)];
+        }
+        __atomic_store_n(&queue->tail, tail + count, __ATOMIC_RELEASE);
+
+        __atomic_add_fetch(&queue->stats.batches, 1, __ATOMIC_RELAXED);
+        queue->fn(queue->data, batch, count);
+    }
+}
+
+internal b8
+input_queue_init(input_queue *queue, input_batch_fn *fn, void *data)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->fn = fn;
+    queue->data = data;
+    if (sem_init(&queue->wake, 0, 0) == -1)
+    {
+        return false;
+    }
+    if (pthread_create(&queue->thread, NULL, input_queue_consumer_main, queue) != 0)
+    {
+        sem_destroy(&queue->wake);
+        return false;
+    }
+    return true;
+}
+
+internal void
+input_queue_wake(input_queue *queue)
+{
+    if (__atomic_exchange_n(&queue->consumer_sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        sem_post(&queue->wake);
+    }
+}
+
+/* Producer side. Returns false and counts an overflow when full. */
+internal b8
+input_queue_push(input_queue *queue, input_event *event)
+{
+    u32 head = queue->head;
+    u32 tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= INPUT_QUEUE_SIZE)
+    {
+        ++queue->stats.overflows;
+        return false;
+    }
+
+    queue->events[head & (INPUT_QUEUE_SIZE - 1)] = *event;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_SEQ_CST);
+
+    ++queue->stats.pushed;
+    u32 depth = head + 1 - tail;
+    if (depth > queue->stats.high_water)
+    {
+        queue->stats.high_water = depth;
+    }
+    input_queue_wake(queue);
+    return true;
+}
+
+/* Lets the consumer drain what is queued, then joins it */
+internal void
+input_queue_destroy(input_queue *queue)
+{
+    __atomic_store_n(&queue->quit, true, __ATOMIC_SEQ_CST);
+    sem_post(&queue->wake);
+    pthread_join(queue->thread, NULL);
+    sem_destroy(&queue->wake);
+}
+
+internal void
+input_queue_print_stats(input_queue *queue)
+{
+    u64 batches = __atomic_load_n(&queue->stats.batches, __ATOMIC_RELAXED);
+    fprintf(stderr, "input queue: %llu events in %llu batches, high water %u/%u, "
+        "%llu overflows\n",
+        (unsigned long long)queue->stats.pushed,
+        (unsigned long long)batches,
+        queue->stats.high_water, INPUT_QUEUE_SIZE,
+        (unsigned long long)queue->stats.overflows
+    );
+}
@@ -0,0 +1,200 @@
+/* Client-side key repeat. The most recently pressed key that the keymap
+ * marks as repeating fires after `delay` ms and then `rate` times a
+ * second, from one periodic timerfd in the event loop however many keys
+ * are held. A wakeup that finds several expirations, because the loop
+ * was stalled, emits every repeat it missed, up to a cap. How late each
+ * wakeup ran against its ideal time is sampled for the jitter stats. */
+
+/* Power of two */
+#define KEY_REPEAT_SAMPLES 1024
+/* Repeats emitted by one late wakeup, the rest are dropped */
+#define KEY_REPEAT_MAX_CATCH_UP 32
+#define KEY_REPEAT_KEYCODES 256
+
+/* `key` is the evdev code, `time` the wl_keyboard timestamp in ms the
+ * repeat would have had if the compositor sent it */
+typedef void key_repeat_fn(void *data, u32 key, u32 time);
+
+struct key_repeat_stats
+{
+    u64 repeats;
+    u64 wakeups;
+    u64 catch_up_wakeups;
+    u64 dropped;
+    u64 sample_count;
+    /* How late each wakeup ran, in ns */
+    u64 lateness[KEY_REPEAT_SAMPLES];
+};
+
+/* Runs on the dispatch thread, except key_repeat_set_keys */
+struct key_repeat
+{
+    event_source *timer;
+    key_repeat_fn *fn;
+    void *data;
+
+    s32 rate;
+    s32 delay;
+    /* Bit per xkb keycode, written by whoever owns the keymap */
+    u8 repeat_keys[KEY_REPEAT_KEYCODES / 8];
+
+    b8 active;
+    u32 key;
+    u32 press_time;
+    u64 first_ns;
+    u64 delay_ns;
+    u64 interval_ns;
+    u64 expirations;
+
+    key_repeat_stats stats;
+};
+
+internal void
+key_repeat_fire(void *data, u64 count)
+{
+    key_repeat *repeat = (key_repeat*)data;
+    if (!repeat->active)
+    {
+        return;
+    }
+
+    u64 now = clock_ns();
+    u64 first = repeat->expirations;
+    repeat->expirations += count;
+    ++repeat->stats.wakeups;
+
+    /* Measured against the newest expiration, the timer's own period
+     * keeps earlier ones on schedule */
+    u64 expected = repeat->first_ns + (repeat->expirations - 1) * repeat->interval_ns;
+    u64 lateness = now > expected ? now - expected : 0;
+    repeat->stats.lateness[repeat->stats.sample_count++ & (KEY_REPEAT_SAMPLES - 1)] = lateness;
+
+    u64 emit = count;
+    if (count > 1)
+    {
+        ++repeat->stats.catch_up_wakeups;
+    }
+    if (emit > KEY_REPEAT_MAX_CATCH_UP)
+    {
+        repeat->stats.dropped += emit - KEY_REPEAT_MAX_CATCH_UP;
+        first += emit - KEY_REPEAT_MAX_CATCH_UP;
+        emit = KEY_REPEAT_MAX_CATCH_UP;
+    }
+    for (u64 i = 0; i < emit; ++i)
+    {
+        u64 offset_ns = repeat->delay_ns + (first + i) * repeat->interval_ns;
+        repeat->fn(repeat->data, repeat->key, repeat->press_time + (u32)(offset_ns / 1000000));
+    }
+    repeat->stats.repeats += emit;
+}
+
+internal b8
+key_repeat_init(key_repeat *repeat, event_loop *loop, key_repeat_fn *fn, void *data)
+{
+    *repeat = {};
+    repeat->fn = fn;
+    repeat->data = data;
+    /* Common compositor defaults until repeat_info arrives */
+    repeat->rate = 25;
+    repeat->delay = 600;
+    repeat->timer = event_loop_add_timer(loop, key_repeat_fire, repeat);
+    return repeat->timer != NULL;
+}
+
+/* From wl_keyboard.repeat_info, a rate of 0 turns repeat off. Takes
+ * effect from the next press. */
+internal void
+key_repeat_set_info(key_repeat *repeat, s32 rate, s32 delay)
+{
+    repeat->rate = rate > 0 ? rate : 0;
+    repeat->delay = delay > 0 ? delay : 0;
+}
+
+/* Which xkb keycodes repeat, NULL for none. Safe from any thread. */
+internal void
+key_repeat_set_keys(key_repeat *repeat, const u8 *keys)
+{
+    for (u32 i = 0; i < KEY_REPEAT_KEYCODES / 8; ++i)
+    {
+        __atomic_store_n(&repeat->repeat_keys[i], keys ? keys[i] : 0, __ATOMIC_RELAXED);
+    }
+}
+
+internal void
+key_repeat_stop(key_repeat *repeat)
+{
+    if (repeat->active)
+    {
+        event_loop_timer_arm(repeat->timer, 0, 0);
+        repeat->active = false;
+    }
+}
+
+internal void
+key_repeat_press(key_repeat *repeat, u32 key, u32 time)
+{
+    u32 keycode = key + 8;
+    b8 repeats = keycode < KEY_REPEAT_KEYCODES &&
+        (__atomic_load_n(&repeat->repeat_keys[keycode / 8], __ATOMIC_RELAXED) >> (keycode % 8)) & 1;
+    if (repeat->rate == 0)
+    {
+        key_repeat_stop(repeat);
+        return;
+    }
+    /* A modifier pressed while a letter is held leaves it repeating */
+    if (!repeats)
+    {
+        return;
+    }
+
+    repeat->active = true;
+    repeat->key = key;
+    repeat->press_time = time;
+    repeat->expirations = 0;
+    repeat->delay_ns = (u64)repeat->delay * 1000000ull;
+    repeat->interval_ns = 1000000000ull / repeat->rate;
+    /* A zero delay would disarm the timer */
+    u64 delay_ns = repeat->delay_ns ? repeat->delay_ns : 1;
+    repeat->first_ns = clock_ns() + delay_ns;
+    event_loop_timer_arm(repeat->timer, delay_ns, repeat->interval_ns);
+}
+
+internal void
+key_repeat_release(key_repeat *repeat, u32 key)
+{
+    if (repeat->active && repeat->key == key)
+    {
+        key_repeat_stop(repeat);
+    }
+}
+
+internal void
+key_repeat_print_stats(key_repeat *repeat)
+{
+    fprintf(stderr, "key repeat: %llu repeats from %llu wakeups, %llu caught up, "
+        "%llu dropped, rate %d/s after %d ms\n",
+        (unsigned long long)repeat->stats.repeats,
+        (unsigned long long)repeat->stats.wakeups,
+        (unsigned long long)repeat->stats.catch_up_wakeups,
+        (unsigned long long)repeat->stats.dropped,
+        repeat->rate, repeat->delay
+    );
+
+    u64 count = repeat->stats.sample_count < KEY_REPEAT_SAMPLES
+        ? repeat->stats.sample_count : KEY_REPEAT_SAMPLES;
+    if (count == 0)
+    {
+        return;
+    }
+    local_persist u64 lateness[KEY_REPEAT_SAMPLES];
+    memcpy(lateness, repeat->stats.lateness, count * sizeof(lateness[0]));
+    qsort(lateness, count, sizeof(lateness[0]), compare_u64);
+    fprintf(stderr, "key repeat: wakeup lateness over last %llu: min %.3f ms, "
+        "median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        (unsigned long long)count,
+        lateness[0] / 1e6,
+        lateness[count / 2] / 1e6,
+        lateness[(count - 1) * 99 / 100] / 1e6,
+        lateness[count - 1] / 1e6
+    );
+}
@@ -0,0 +1,161 @@
+/* Keysym and UTF-8 for every keycode under one modifier/group state,
+ * so translating a key is an array index instead of two xkb lookups.
+ * Tables are keyed by the effective modifier mask and layout, built
+ * lazily on the first key pressed in that state and kept in a small LRU
+ * cache, so switching back and forth between e.g. Shift and no Shift
+ * only costs a search of a handful of slots. Any keymap change drops
+ * them all. */
+
+#define KEY_TABLE_KEYCODES 256
+#define KEY_TABLE_CACHE_SIZE 8
+/* Longest string xkb produces for one key is a few code points */
+#define KEY_TABLE_UTF8_SIZE 12
+
+struct key_table_entry
+{
+    xkb_keysym_t sym;
+    char utf8[KEY_TABLE_UTF8_SIZE];
+};
+
+struct key_table
+{
+    b8 valid;
+    xkb_mod_mask_t mods;
+    xkb_layout_index_t layout;
+    u64 last_used;
+    key_table_entry keys[KEY_TABLE_KEYCODES];
+};
+
+struct key_table_stats
+{
+    u64 lookups;
+    u64 builds;
+    u64 build_ns;
+    u64 switches;
+    u64 uncached;
+};
+
+struct key_tables
+{
+    key_table tables[KEY_TABLE_CACHE_SIZE];
+    /* NULL until a key is looked up in the current state */
+    key_table *current;
+    xkb_mod_mask_t mods;
+    xkb_layout_index_t layout;
+    u64 use_count;
+    /* Keycodes past the table */
+    key_table_entry uncached;
+    key_table_stats stats;
+};
+
+internal void
+key_table_fill(key_table_entry *entry, xkb_state *xkb_state, xkb_keycode_t keycode)
+{
+    entry->sym = xkb_state_key_get_one_sym(xkb_state, keycode);
+    /* Truncated strings still come back NUL terminated */
+    xkb_state_key_get_utf8(xkb_state, keycode, entry->utf8, sizeof(entry->utf8));
+}
+
+/* Call whenever the keymap changes */
+internal void
+key_tables_reset(key_tables *tables)
+{
+    for (u32 i = 0; i < KEY_TABLE_CACHE_SIZE; ++i)
+    {
+        tables->tables[i].valid = false;
+    }
+    tables->current = NULL;
+    tables->mods = 0;
+    tables->layout = 0;
+}
+
+/* Call after every xkb_state_update_mask */
+internal void
+key_tables_update(key_tables *tables, xkb_state *xkb_state)
+{
+    xkb_mod_mask_t mods = xkb_state_serialize_mods(xkb_state, XKB_STATE_MODS_EFFECTIVE);
+    xkb_layout_index_t layout = xkb_state_serialize_layout(xkb_state, XKB_STATE_LAYOUT_EFFECTIVE);
+    if (tables->current && tables->mods == mods && tables->layout == layout)
+    {
+        return;
+    }
+
+    ++tables->stats.switches;
+    tables->mods = mods;
+    tables->layout = layout;
+    tables->current = NULL;
+    for (u32 i = 0; i < KEY_TABLE_CACHE_SIZE; ++i)
+    {
+        key_table *table = &tables->tables[i];
+        if (table->valid && table->mods == mods && table->layout == layout)
+        {
+            tables->current = table;
+            table->last_used = ++tables->use_count;
+            return;
+        }
+    }
+}
+
+internal key_table *
+key_tables_build(key_tables *tables, xkb_state *xkb_state)
+{
+    key_table *table = &tables->tables[0];
+    for (u32 i = 0; i < KEY_TABLE_CACHE_SIZE; ++i)
+    {
+        if (!tables->tables[i].valid)
+        {
+            table = &tables->tables[i];
+            break;
+        }
+        if (tables->tables[i].last_used < table->last_used)
+        {
+            table = &tables->tables[i];
+        }
+    }
+
+    u64 start = clock_ns();
+    for (u32 keycode = 0; keycode < KEY_TABLE_KEYCODES; ++keycode)
+    {
+        key_table_fill(&table->keys[keycode], xkb_state, keycode);
+    }
+    tables->stats.build_ns += clock_ns() - start;
+    ++tables->stats.builds;
+
+    table->valid = true;
+    table->mods = tables->mods;
+    table->layout = tables->layout;
+    table->last_used = ++tables->use_count;
+    return table;
+}
+
+/* `keycode` is an xkb keycode, i.e. the evdev code plus 8. The entry stays
+ * valid until the next call. */
+internal key_table_entry *
+key_tables_lookup(key_tables *tables, xkb_state *xkb_state, xkb_keycode_t keycode)
+{
+    ++tables->stats.lookups;
+    if (keycode >= KEY_TABLE_KEYCODES)
+    {
+        ++tables->stats.uncached;
+        key_table_fill(&tables->uncached, xkb_state, keycode);
+        return &tables->uncached;
+    }
+    if (!tables->current)
+    {
+        tables->current = key_tables_build(tables, xkb_state);
+    }
+    return &tables->current->keys[keycode];
+}
+
+internal void
+key_tables_print_stats(key_tables *tables)
+{
+    fprintf(stderr, "key tables: %llu lookups, %llu state switches, %llu builds "
+        "(mean %.1f us), %llu past the table\n",
+        (unsigned long long)tables->stats.lookups,
+        (unsigned long long)tables->stats.switches,
+        (unsigned long long)tables->stats.builds,
+        tables->stats.builds ? tables->stats.build_ns / 1e3 / tables->stats.builds : 0.0,
+        (unsigned long long)tables->stats.uncached
+    );
+}
@@ -0,0 +1,315 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Compiled keymaps, keyed by a hash of the text the compositor sent.
+ * Compositors resend the same few keymaps on layout switches and seat
+ * hotplug, so anything seen before is handed back with another reference
+ * instead of being recompiled. Hits are confirmed against a copy of the
+ * text, the hash only picks the slot.
+ *
+ * xkbcommon has no serialized form of a compiled keymap, so the optional
+ * on-disk cache holds what can be derived from one: keycode range, layout
+ * and modifier names and which keys repeat, one file per hash. A keymap
+ * seen in an earlier run is still compiled on arrival, the disk only
+ * spares walking it for the metadata. Putting the compile off until the
+ * first key would move it onto that key rather than save it. */
+
+#define KEYMAP_CACHE_SIZE 8
+#define KEYMAP_MAX_LAYOUTS 4
+#define KEYMAP_MAX_MODS 16
+#define KEYMAP_NAME_SIZE 32
+#define KEYMAP_KEYCODES 256
+#define KEYMAP_DISK_VERSION 1
+
+global_variable const char keymap_disk_magic[8] = { 'W', 'L', 'K', 'E', 'Y', 'M', 'A', 'P' };
+
+/* Written to disk as is */
+struct keymap_metadata
+{
+    char magic[8];
+    u32 version;
+    u32 text_size;
+    u64 hash;
+    u32 min_keycode;
+    u32 max_keycode;
+    u32 layout_count;
+    u32 mod_count;
+    char layout_names[KEYMAP_MAX_LAYOUTS][KEYMAP_NAME_SIZE];
+    char mod_names[KEYMAP_MAX_MODS][KEYMAP_NAME_SIZE];
+    /* Bit per keycode below KEYMAP_KEYCODES */
+    u8 repeats[KEYMAP_KEYCODES / 8];
+};
+
+struct keymap_cache_entry
+{
+    u64 hash;
+    u8 *text;
+    u32 text_size;
+    u64 last_used;
+    xkb_keymap *keymap;
+    keymap_metadata metadata;
+};
+
+struct keymap_cache_stats
+{
+    u64 hits;
+    u64 misses;
+    u64 disk_hits;
+    u64 disk_writes;
+    u64 compile_ns;
+    u64 evictions;
+};
+
+/* Not thread-safe, xkbcommon reference counts are not atomic either */
+struct keymap_cache
+{
+    xkb_context *xkb_context;
+    /* NULL when the disk cache is off */
+    const char *disk_dir;
+    u64 use_count;
+    keymap_cache_entry entries[KEYMAP_CACHE_SIZE];
+    keymap_cache_stats stats;
+};
+
+/* Eight bytes per step, keymaps are tens of kilobytes of text */
+internal u64
+keymap_hash(const u8 *data, size_t size)
+{
+    u64 hash = 0x9e3779b97f4a7c15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    u64 tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+internal void
+keymap_cache_init(keymap_cache *cache, xkb_context *xkb_context, const char *disk_dir)
+{
+    *cache = {};
+    cache->xkb_context = xkb_context;
+    cache->disk_dir = disk_dir;
+    if (disk_dir)
+    {
+        mkdir(disk_dir, 0700);
+    }
+}
+
+internal void
+keymap_metadata_build(keymap_metadata *metadata, xkb_keymap *keymap, u64 hash, u32 text_size)
+{
+    *metadata = {};
+    memcpy(metadata->magic, keymap_disk_magic, sizeof(metadata->magic));
+    metadata->version = KEYMAP_DISK_VERSION;
+    metadata->text_size = text_size;
+    metadata->hash = hash;
+    metadata->min_keycode = xkb_keymap_min_keycode(keymap);
+    metadata->max_keycode = xkb_keymap_max_keycode(keymap);
+
+    metadata->layout_count = xkb_keymap_num_layouts(keymap);
+    for (u32 i = 0; i < metadata->layout_count && i < KEYMAP_MAX_LAYOUTS; ++i)
+    {
+        const char *name = xkb_keymap_layout_get_name(keymap, i);
+        snprintf(metadata->layout_names[i], KEYMAP_NAME_SIZE, "%s", name ? name : "");
+    }
+
+    metadata->mod_count = xkb_keymap_num_mods(keymap);
+    for (u32 i = 0; i < metadata->mod_count && i < KEYMAP_MAX_MODS; ++i)
+    {
+        const char *name = xkb_keymap_mod_get_name(keymap, i);
+        snprintf(metadata->mod_names[i], KEYMAP_NAME_SIZE, "%s", name ? name : "");
+    }
+
+    for (u32 keycode = metadata->min_keycode;
+         keycode <= metadata->max_keycode && keycode < KEYMAP_KEYCODES;
+         ++keycode)
+    {
+        if (xkb_keymap_key_repeats(keymap, keycode))
+        {
+            metadata->repeats[keycode / 8] |= 1 << (keycode % 8);
+        }
+    }
+}
+
+internal void
+keymap_disk_path(keymap_cache *cache, u64 hash, char *path, size_t path_size)
+{
+    snprintf(path, path_size, "%s/%016llx.keymap", cache->disk_dir, (unsigned long long)hash);
+}
+
+internal b8
+keymap_disk_load(keymap_cache *cache, u64 hash, u32 text_size, keymap_metadata *metadata)
+{
+    char path[PATH_MAX];
+    keymap_disk_path(cache, hash, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+    ssize_t result = read(fd, metadata, sizeof(*metadata));
+    close(fd);
+
+    return result == sizeof(*metadata) &&
+        memcmp(metadata->magic, keymap_disk_magic, sizeof(metadata->magic)) == 0 &&
+        metadata->version == KEYMAP_DISK_VERSION &&
+        metadata->hash == hash &&
+        metadata->text_size == text_size;
+}
+
+/* Written to a temporary name and renamed, so readers never see half */
+internal void
+keymap_disk_store(keymap_cache *cache, keymap_metadata *metadata)
+{
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    keymap_disk_path(cache, metadata->hash, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", path, getpid());
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        return;
+    }
+    b8 written = write(fd, metadata, sizeof(*metadata)) == sizeof(*metadata);
+    close(fd);
+    if (written && rename(temp_path, path) == 0)
+    {
+        ++cache->stats.disk_writes;
+    }
+    else
+    {
+        unlink(temp_path);
+    }
+}
+
+internal void
+keymap_cache_entry_clear(keymap_cache_entry *entry)
+{
+    xkb_keymap_unref(entry->keymap);
+    free(entry->text);
+    *entry = {};
+}
+
+internal xkb_keymap *
+keymap_compile(keymap_cache *cache, const u8 *text, u32 length)
+{
+    u64 start = clock_ns();
+    xkb_keymap *keymap = xkb_keymap_new_from_buffer(
+        cache->xkb_context,
+        (const char*)text,
+        length,
+        XKB_KEYMAP_FORMAT_TEXT_V1,
+        XKB_KEYMAP_COMPILE_NO_FLAGS
+    );
+    cache->stats.compile_ns += clock_ns() - start;
+    return keymap;
+}
+
+/* Finds or adds the entry for a keymap text, compiled and with its
+ * metadata filled in. The cache keeps the keymap's reference. Returns NULL
+ * if the text does not compile. The entry stays valid until the next
+ * lookup. */
+internal keymap_cache_entry *
+keymap_cache_lookup(keymap_cache *cache, const u8 *text, u32 size)
+{
+    /* The text the compositor sends is usually NUL terminated */
+    u32 length = (u32)strnlen((const char*)text, size);
+    u64 hash = keymap_hash(text, length);
+
+    keymap_cache_entry *victim = &cache->entries[0];
+    for (u32 i = 0; i < KEYMAP_CACHE_SIZE; ++i)
+    {
+        keymap_cache_entry *entry = &cache->entries[i];
+        if (entry->text && entry->hash == hash && entry->text_size == length &&
+            memcmp(entry->text, text, length) == 0)
+        {
+            ++cache->stats.hits;
+            entry->last_used = ++cache->use_count;
+            return entry;
+        }
+        if (!entry->text)
+        {
+            victim = entry;
+        }
+        else if (victim->text && entry->last_used < victim->last_used)
+        {
+            victim = entry;
+        }
+    }
+
+    ++cache->stats.misses;
+    xkb_keymap *keymap = keymap_compile(cache, text, length);
+    if (!keymap)
+    {
+        return NULL;
+    }
+    keymap_metadata metadata;
+    if (cache->disk_dir && keymap_disk_load(cache, hash, length, &metadata))
+    {
+        ++cache->stats.disk_hits;
+    }
+    else
+    {
+        keymap_metadata_build(&metadata, keymap, hash, length);
+        if (cache->disk_dir)
+        {
+            keymap_disk_store(cache, &metadata);
+        }
+    }
+
+    u8 *copy = (u8*)malloc(length);
+    if (!copy)
+    {
+        xkb_keymap_unref(keymap);
+        return NULL;
+    }
+    memcpy(copy, text, length);
+
+    if (victim->text)
+    {
+        ++cache->stats.evictions;
+        keymap_cache_entry_clear(victim);
+    }
+    victim->hash = hash;
+    victim->text = copy;
+    victim->text_size = length;
+    victim->last_used = ++cache->use_count;
+    victim->keymap = keymap;
+    victim->metadata = metadata;
+    return victim;
+}
+
+internal void
+keymap_cache_destroy(keymap_cache *cache)
+{
+    for (u32 i = 0; i < KEYMAP_CACHE_SIZE; ++i)
+    {
+        if (cache->entries[i].text)
+        {
+            keymap_cache_entry_clear(&cache->entries[i]);
+        }
+    }
+}
+
+internal void
+keymap_cache_print_stats(keymap_cache *cache)
+{
+    fprintf(stderr, "keymap cache: %llu hits, %llu misses (%.2f ms compiling), "
+        "%llu evictions, %llu disk hits, %llu disk writes\n",
+        (unsigned long long)cache->stats.hits,
+        (unsigned long long)cache->stats.misses,
+        cache->stats.compile_ns / 1e6,
+        (unsigned long long)cache->stats.evictions,
+        (unsigned long long)cache->stats.disk_hits,
+        (unsigned long long)cache->stats.disk_writes
+    );
+}
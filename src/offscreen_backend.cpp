@@ -0,0 +1,242 @@
+/* Renders into anonymous memory with no compositor, for profiling the
+ * content code on its own. Frames are paced by the backend itself, at a
+ * fixed rate or back to back, and "presenting" one releases it at once.
+ * Everything between acquire and present counts as draw time, which the
+ * pixel and bandwidth figures are measured against. */
+
+#include <time.h>
+
+#define OFFSCREEN_BUFFERS 2
+
+/* `time` is in ms, like a wl_callback.done timestamp */
+typedef void offscreen_frame_fn(void *data, u32 time);
+
+struct offscreen_stats
+{
+    u64 frames;
+    u64 drawn;
+    u64 missed;
+    u64 draw_ns;
+    u64 start_ns;
+    u64 end_ns;
+};
+
+struct offscreen_backend
+{
+    pool_buffer buffers[OFFSCREEN_BUFFERS];
+    u32 next;
+    pixel_format format;
+    b8 huge_pages;
+    /* Bytes moved are derived from what the content code reports */
+    render_stats *render_stats;
+    u64 acquire_ns;
+    u32 rate;
+    s32 destination_width;
+    s32 destination_height;
+    offscreen_stats stats;
+};
+
+internal void
+offscreen_buffer_destroy(pool_buffer *buffer)
+{
+    if (buffer->data)
+    {
+        munmap(buffer->data, buffer->size);
+    }
+    *buffer = {};
+}
+
+internal b8
+offscreen_buffer_create(offscreen_backend *backend, pool_buffer *buffer, s32 width, s32 height)
+{
+    s32 stride = width * pixel_format_bytes(backend->format);
+    size_t size = (size_t)stride * height;
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    if (backend->huge_pages && size >= BUFFER_POOL_HUGE_THRESHOLD)
+    {
+        shm_advise_huge(data, size);
+    }
+
+    buffer->data = data;
+    buffer->size = size;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->stride = stride;
+    buffer->format = backend->format;
+    buffer->content_offset = -1;
+    return true;
+}
+
+/* Alternates between two buffers so that scrolling always has the
+ * previous frame to copy from */
+internal pool_buffer *
+offscreen_backend_acquire(void *data, s32 width, s32 height, s32 offset)
+{
+    offscreen_backend *backend = (offscreen_backend*)data;
+    backend->acquire_ns = clock_ns();
+
+    pool_buffer *buffer = &backend->buffers[backend->next];
+    if (buffer->data && (buffer->width != width || buffer->height != height))
+    {
+        offscreen_buffer_destroy(buffer);
+    }
+    if (!buffer->data && !offscreen_buffer_create(backend, buffer, width, height))
+    {
+        return NULL;
+    }
+    backend->next = (backend->next + 1) % OFFSCREEN_BUFFERS;
+    buffer->busy = true;
+    return buffer;
+}
+
+internal void
+offscreen_backend_present(void *data, pool_buffer *buffer, damage_region *damage)
+{
+    offscreen_backend *backend = (offscreen_backend*)data;
+    if (buffer)
+    {
+        backend->stats.draw_ns += clock_ns() - backend->acquire_ns;
+        ++backend->stats.drawn;
+        buffer->busy = false;
+    }
+    damage_region_clear(damage);
+}
+
+/* Nothing scales the buffers here, the destination size is only noted to
+ * let the content code exercise dynamic resolution */
+internal void
+offscreen_backend_set_destination(void *data, s32 width, s32 height)
+{
+    offscreen_backend *backend = (offscreen_backend*)data;
+    backend->destination_width = width;
+    backend->destination_height = height;
+}
+
+internal u64
+offscreen_backend_refresh_interval(void *data)
+{
+    offscreen_backend *backend = (offscreen_backend*)data;
+    return backend->rate ? 1000000000ull / backend->rate : 0;
+}
+
+internal void
+offscreen_backend_print_stats(void *data)
+{
+    offscreen_backend *backend = (offscreen_backend*)data;
+    offscreen_stats *stats = &backend->stats;
+    f64 seconds = (stats->end_ns - stats->start_ns) / 1e9;
+    if (stats->frames == 0 || seconds <= 0)
+    {
+        return;
+    }
+
+    render_stats *render = backend->render_stats;
+    u64 pixels = render->rasterized + render->copied;
+    /* Rasterized pixels are written, copied ones read and written */
+    u64 bytes = (render->rasterized + render->copied * 2) * pixel_format_bytes(backend->format);
+    f64 draw_seconds = stats->draw_ns / 1e9;
+
+    char target[32] = "unlimited";
+    if (backend->rate)
+    {
+        snprintf(target, sizeof(target), "%u", backend->rate);
+    }
+    fprintf(stderr, "offscreen: %llu frames (%llu drawn, %llu late) in %.3f s, "
+        "%.1f fps, target %s\n",
+        (unsigned long long)stats->frames,
+        (unsigned long long)stats->drawn,
+        (unsigned long long)stats->missed,
+        seconds,
+        stats->frames / seconds,
+        target
+    );
+    fprintf(stderr, "offscreen: %s, %.3f ns/pixel, %.2f GB/s over %.3f s of drawing\n",
+        pixel_formats[backend->format].name,
+        pixels ? (f64)stats->draw_ns / pixels : 0.0,
+        draw_seconds > 0 ? bytes / draw_seconds / 1e9 : 0.0,
+        draw_seconds
+    );
+}
+
+internal void
+offscreen_backend_destroy(void *data)
+{
+    offscreen_backend *backend = (offscreen_backend*)data;
+    for (u32 i = 0; i < OFFSCREEN_BUFFERS; ++i)
+    {
+        offscreen_buffer_destroy(&backend->buffers[i]);
+    }
+}
+
+internal render_backend
+offscreen_backend_init(offscreen_backend *backend, render_stats *render_stats,
+    pixel_format format, b8 huge_pages)
+{
+    *backend = {};
+    backend->render_stats = render_stats;
+    backend->format = format;
+    backend->huge_pages = huge_pages;
+
+    render_backend result = {};
+    result.name = "offscreen";
+    result.data = backend;
+    result.acquire = offscreen_backend_acquire;
+    result.present = offscreen_backend_present;
+    result.set_destination = offscreen_backend_set_destination;
+    result.refresh_interval = offscreen_backend_refresh_interval;
+    result.print_stats = offscreen_backend_print_stats;
+    result.destroy = offscreen_backend_destroy;
+    return result;
+}
+
+/* Calls `fn` `frames` times, `rate` times a second or as fast as it
+ * returns when `rate` is 0. The timestamps advance by the frame interval,
+ * or by `unlimited_step` ms at an unlimited rate, so the animation moves
+ * the same way whatever the host manages. They are the elapsed ms rounded
+ * down, so above 1000 Hz some frames share one and have nothing new to
+ * draw, but the animation still keeps time. A frame that starts after the
+ * next one was due is counted late and the schedule moves on from it. */
+internal void
+offscreen_backend_run(offscreen_backend *backend, u32 frames, u32 rate, u32 unlimited_step,
+    offscreen_frame_fn *fn, void *data)
+{
+    backend->rate = rate;
+    u64 interval_ns = rate ? 1000000000ull / rate : 0;
+    u64 step_ns = rate ? interval_ns : unlimited_step * 1000000ull;
+
+    u64 start = clock_ns();
+    backend->stats.start_ns = start;
+    u64 due = start;
+    for (u32 i = 0; i < frames; ++i)
+    {
+        if (interval_ns)
+        {
+            u64 now = clock_ns();
+            if (now < due)
+            {
+                timespec ts;
+                ts.tv_sec = due / 1000000000ull;
+                ts.tv_nsec = due % 1000000000ull;
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                {
+                }
+            }
+            else if (now >= due + interval_ns)
+            {
+                ++backend->stats.missed;
+                due = now;
+            }
+            due += interval_ns;
+        }
+
+        /* 0 is the "no previous frame" timestamp */
+        fn(data, (u32)((i + 1) * step_ns / 1000000));
+        ++backend->stats.frames;
+    }
+    backend->stats.end_ns = clock_ns();
+}
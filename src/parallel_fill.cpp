@@ -0,0 +1,41 @@
+/* Surfaces below this size are filled on the dispatch thread, where waking
+ * the workers would cost more than it saves */
+#define PARALLEL_FILL_MIN_PIXELS (512 * 512)
+/* Rows per work item are picked so one band is about this many bytes */
+#define PARALLEL_FILL_BAND_BYTES (128 * 1024)
+
+struct checkerboard_job
+{
+    u8 *data;
+    s32 stride;
+    s32 width;
+    s32 offset;
+    pixel_format format;
+    b8 non_temporal;
+};
+
+internal void
+checkerboard_band(void *data, s32 y0, s32 y1)
+{
+    checkerboard_job *job = (checkerboard_job*)data;
+    checkerboard_fill(job->data, job->stride, 0, y0, job->width, y1, job->offset,
+        job->format, job->non_temporal);
+}
+
+internal void
+checkerboard_fill_parallel(thread_pool *pool, u8 *data, s32 stride,
+    s32 width, s32 height, s32 offset, pixel_format format)
+{
+    checkerboard_job job;
+    job.data = data;
+    job.stride = stride;
+    job.width = width;
+    job.offset = offset;
+    job.format = format;
+    job.non_temporal = (size_t)stride * height >= PERIODIC_NON_TEMPORAL_MIN_BYTES;
+
+    s32 band_rows = PARALLEL_FILL_BAND_BYTES / stride;
+    s32 min_rows = PARALLEL_FILL_MIN_PIXELS / width;
+    thread_pool_run(pool, checkerboard_band, &job, height,
+        band_rows > 8 ? band_rows : 8, min_rows);
+}
@@ -0,0 +1,409 @@
+#include <immintrin.h>
+
+#define CHECKER_COLOR_DARK  0xFF666666
+#define CHECKER_COLOR_LIGHT 0xFFEEEEEE
+/* The checkerboard repeats every 16 pixels along a row */
+#define CHECKER_PERIOD      16
+/* Two opaque flat colors this far apart stay distinct and flat at 5 bits
+ * per channel, see pixel_format_choose */
+#define CHECKER_ALPHA        false
+#define CHECKER_CHANNEL_BITS 5
+
+/* A span kernel fills `bytes` bytes of a row from a periodic byte pattern.
+ * `pattern` holds the period repeated until it is PATTERN_BYTES long, so a
+ * full vector can be loaded at any phase without wrapping. `period` is a
+ * power of two no larger than 64 and `phase` is below it. */
+#define PATTERN_BYTES 128
+
+typedef void pattern_span_fn(u8 *dst, size_t bytes, const u8 *pattern,
+    size_t phase, size_t period);
+
+internal void
+pattern_span_scalar(u8 *dst, size_t bytes, const u8 *pattern, size_t phase, size_t period)
+{
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        memcpy(dst + i, pattern + ((phase + i) & (period - 1)), 8);
+    }
+    memcpy(dst + i, pattern + ((phase + i) & (period - 1)), bytes - i);
+}
+
+__attribute__((target("sse2"))) internal void
+pattern_span_sse2(u8 *dst, size_t bytes, const u8 *pattern, size_t phase, size_t period)
+{
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pattern + ((phase + i) & (period - 1))));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pattern + ((phase + i + 16) & (period - 1))));
+        _mm_storeu_si128((__m128i*)(dst + i), a);
+        _mm_storeu_si128((__m128i*)(dst + i + 16), b);
+    }
+    memcpy(dst + i, pattern + ((phase + i) & (period - 1)), bytes - i);
+}
+
+__attribute__((target("avx2"))) internal void
+pattern_span_avx2(u8 *dst, size_t bytes, const u8 *pattern, size_t phase, size_t period)
+{
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pattern + ((phase + i) & (period - 1))));
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+    memcpy(dst + i, pattern + ((phase + i) & (period - 1)), bytes - i);
+}
+
+__attribute__((target("avx512f"))) internal void
+pattern_span_avx512(u8 *dst, size_t bytes, const u8 *pattern, size_t phase, size_t period)
+{
+    size_t i = 0;
+    for (; i + 64 <= bytes; i += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)(pattern + ((phase + i) & (period - 1))));
+        _mm512_storeu_si512((void*)(dst + i), v);
+    }
+    memcpy(dst + i, pattern + ((phase + i) & (period - 1)), bytes - i);
+}
+
+global_variable pattern_span_fn *pattern_span = pattern_span_scalar;
+global_variable const char *pattern_span_name = "scalar";
+
+internal void
+pattern_fill_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        pattern_span = pattern_span_avx512;
+        pattern_span_name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        pattern_span = pattern_span_avx2;
+        pattern_span_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        pattern_span = pattern_span_sse2;
+        pattern_span_name = "sse2";
+    }
+}
+
+/* Reference implementation, kept as the definition of the pattern */
+template <pixel_format format>
+internal void
+checkerboard_fill_reference(typename pixel_traits<format>::pixel *data, s32 width, s32 height,
+    s32 offset)
+{
+    for (s32 y = 0; y < height; ++y)
+    {
+        for (s32 x = 0; x < width; ++x)
+        {
+            if (((x + offset) + ( y + offset) / 8 * 8) % 16 < 8)
+                data[y * width + x] = pixel_traits<format>::pack(CHECKER_COLOR_DARK);
+            else
+                data[y * width + x] = pixel_traits<format>::pack(CHECKER_COLOR_LIGHT);
+        }
+    }
+}
+
+/* Periodic patterns: rows fall into a few classes and all rows of a class
+ * are identical. Each class is rendered once per fill into a scratch
+ * buffer small enough to stay in cache, then every output row is a bulk
+ * copy of its template. */
+#define PERIODIC_MAX_CLASSES 16
+#define PERIODIC_SCRATCH_BYTES (64 * 1024)
+/* Frames at least this large should be written with streaming stores:
+ * they do not fit in cache and are only read again by the compositor */
+#define PERIODIC_NON_TEMPORAL_MIN_BYTES (16 * 1024 * 1024)
+
+/* Renders pixels [x0, x1) of row y to `row`, which points at pixel x0 */
+typedef void pattern_row_fn(void *data, u8 *row, s32 x0, s32 x1, s32 y);
+/* Returns the class of row y, below the pattern's class_count */
+typedef s32 pattern_row_class_fn(void *data, s32 y);
+
+struct periodic_pattern
+{
+    pattern_row_fn *fill_row;
+    pattern_row_class_fn *row_class;
+    s32 class_count;
+    s32 bytes_per_pixel;
+    void *data;
+    b8 non_temporal;
+};
+
+alignas(64) global_variable thread_local u8 periodic_scratch[PERIODIC_SCRATCH_BYTES];
+
+__attribute__((target("sse2"))) internal void
+pattern_copy_row_non_temporal(u8 *dst, const u8 *src, size_t bytes)
+{
+    size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (head > bytes)
+    {
+        head = bytes;
+    }
+    memcpy(dst, src, head);
+
+    size_t i = head;
+    for (; i + 64 <= bytes; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_stream_si128((__m128i*)(dst + i), a);
+        _mm_stream_si128((__m128i*)(dst + i + 16), b);
+        _mm_stream_si128((__m128i*)(dst + i + 32), c);
+        _mm_stream_si128((__m128i*)(dst + i + 48), d);
+    }
+    memcpy(dst + i, src + i, bytes - i);
+}
+
+internal void
+periodic_pattern_fill(periodic_pattern *pattern, u8 *dst, s32 stride,
+    s32 x0, s32 y0, s32 x1, s32 y1)
+{
+    if (x1 <= x0 || y1 <= y0)
+    {
+        return;
+    }
+
+    size_t row_bytes = (size_t)(x1 - x0) * pattern->bytes_per_pixel;
+    u8 *first = dst + (size_t)y0 * stride + (size_t)x0 * pattern->bytes_per_pixel;
+
+    /* Not worth a template when each row is only written once anyway */
+    if (y1 - y0 <= pattern->class_count ||
+        pattern->class_count > PERIODIC_MAX_CLASSES ||
+        row_bytes * pattern->class_count > PERIODIC_SCRATCH_BYTES)
+    {
+        for (s32 y = y0; y < y1; ++y)
+        {
+            pattern->fill_row(pattern->data, first + (size_t)(y - y0) * stride, x0, x1, y);
+        }
+        return;
+    }
+
+    b8 non_temporal = pattern->non_temporal;
+    b8 built[PERIODIC_MAX_CLASSES] = {};
+    for (s32 y = y0; y < y1; ++y)
+    {
+        s32 row_class = pattern->row_class(pattern->data, y);
+        u8 *template_row = periodic_scratch + row_bytes * row_class;
+        if (!built[row_class])
+        {
+            pattern->fill_row(pattern->data, template_row, x0, x1, y);
+            built[row_class] = true;
+        }
+
+        u8 *row = first + (size_t)(y - y0) * stride;
+        if (non_temporal)
+        {
+            pattern_copy_row_non_temporal(row, template_row, row_bytes);
+        }
+        else
+        {
+            memcpy(row, template_row, row_bytes);
+        }
+    }
+
+    if (non_temporal)
+    {
+        _mm_sfence();
+    }
+}
+
+struct checkerboard
+{
+    alignas(64) u8 span[PATTERN_BYTES];
+    s32 offset;
+};
+
+template <pixel_format format>
+internal void
+checkerboard_init(checkerboard *board, s32 offset)
+{
+    typedef typename pixel_traits<format>::pixel pixel;
+    pixel *pixels = (pixel*)board->span;
+    for (u32 i = 0; i < PATTERN_BYTES / sizeof(pixel); ++i)
+    {
+        pixels[i] = pixel_traits<format>::pack(
+            i % CHECKER_PERIOD < 8 ? CHECKER_COLOR_DARK : CHECKER_COLOR_LIGHT);
+    }
+    board->offset = offset;
+}
+
+/* Pixel x of row y is dark when (x + offset + row_shift) % 16 < 8 */
+template <pixel_format format>
+internal void
+checkerboard_fill_row(void *data, u8 *row, s32 x0, s32 x1, s32 y)
+{
+    constexpr size_t bytes = sizeof(typename pixel_traits<format>::pixel);
+    checkerboard *board = (checkerboard*)data;
+    s32 row_shift = (y + board->offset) / 8 * 8;
+    size_t phase = (size_t)((x0 + board->offset + row_shift) % CHECKER_PERIOD) * bytes;
+    pattern_span(row, (size_t)(x1 - x0) * bytes, board->span, phase, CHECKER_PERIOD * bytes);
+}
+
+/* row_shift alternates between even and odd multiples of 8 every 8 rows */
+internal s32
+checkerboard_row_class(void *data, s32 y)
+{
+    checkerboard *board = (checkerboard*)data;
+    return ((y + board->offset) / 8) & 1;
+}
+
+template <pixel_format format>
+internal void
+checkerboard_fill_format(u8 *data, s32 stride, s32 x0, s32 y0, s32 x1, s32 y1,
+    s32 offset, b8 non_temporal)
+{
+    checkerboard board;
+    checkerboard_init<format>(&board, offset);
+
+    periodic_pattern pattern;
+    pattern.fill_row = checkerboard_fill_row<format>;
+    pattern.row_class = checkerboard_row_class;
+    pattern.class_count = 2;
+    pattern.bytes_per_pixel = sizeof(typename pixel_traits<format>::pixel);
+    pattern.data = &board;
+    pattern.non_temporal = non_temporal;
+    periodic_pattern_fill(&pattern, data, stride, x0, y0, x1, y1);
+}
+
+typedef void checkerboard_fill_fn(u8 *data, s32 stride, s32 x0, s32 y0, s32 x1, s32 y1,
+    s32 offset, b8 non_temporal);
+
+global_variable checkerboard_fill_fn *checkerboard_fills[PIXEL_FORMAT_COUNT] =
+{
+    checkerboard_fill_format<PIXEL_FORMAT_XRGB8888>,
+    checkerboard_fill_format<PIXEL_FORMAT_ARGB8888>,
+    checkerboard_fill_format<PIXEL_FORMAT_RGB565>,
+};
+
+/* Fills the rectangle [x0, x1) x [y0, y1) of a `format` buffer with the
+ * checkerboard at the given animation offset. The offset must not be
+ * negative. `stride` is in bytes. Large fills may use streaming stores
+ * when `non_temporal` is set. */
+internal void
+checkerboard_fill(u8 *data, s32 stride, s32 x0, s32 y0, s32 x1, s32 y1,
+    s32 offset, pixel_format format, b8 non_temporal = false)
+{
+    checkerboard_fills[format](data, stride, x0, y0, x1, y1, offset, non_temporal);
+}
+
+/* Rectangles the kernels are checked on, in a VERIFY_WIDTH x VERIFY_HEIGHT
+ * buffer. Odd edges and short spans are what the scroll path fills; a few
+ * rows and a single column go around the row templates. */
+#define VERIFY_WIDTH 67
+#define VERIFY_HEIGHT 45
+global_variable const s32 pattern_verify_rects[][4] =
+{
+    { 0, 0, VERIFY_WIDTH, VERIFY_HEIGHT },
+    { 1, 3, 66, 44 },
+    { 3, 0, 8, VERIFY_HEIGHT },
+    { 5, 7, 63, 9 },
+    { 7, 1, 61, 40 },
+    { 9, 2, 10, VERIFY_HEIGHT },
+    { 33, 0, VERIFY_WIDTH, 1 },
+    { 0, 11, 1, 12 },
+};
+
+/* Fills every rectangle with the current kernel, with and without
+ * streaming stores, and compares the whole buffer with the reference:
+ * the rectangle must match it and everything around it must be left
+ * alone. Prints the first mismatch. */
+template <pixel_format format>
+internal b8
+checkerboard_verify_format(s32 offset, const char *kernel)
+{
+    typedef typename pixel_traits<format>::pixel pixel;
+    local_persist pixel expected[VERIFY_WIDTH * VERIFY_HEIGHT];
+    local_persist pixel actual[VERIFY_WIDTH * VERIFY_HEIGHT];
+    pixel untouched;
+    memset(&untouched, 0x5a, sizeof(untouched));
+    checkerboard_fill_reference<format>(expected, VERIFY_WIDTH, VERIFY_HEIGHT, offset);
+
+    for (u32 r = 0; r < sizeof(pattern_verify_rects) / sizeof(pattern_verify_rects[0]); ++r)
+    {
+        const s32 *rect = pattern_verify_rects[r];
+        for (s32 non_temporal = 0; non_temporal < 2; ++non_temporal)
+        {
+            memset(actual, 0x5a, sizeof(actual));
+            checkerboard_fill((u8*)actual, VERIFY_WIDTH * (s32)sizeof(pixel),
+                rect[0], rect[1], rect[2], rect[3], offset, format, non_temporal);
+            for (s32 y = 0; y < VERIFY_HEIGHT; ++y)
+            {
+                for (s32 x = 0; x < VERIFY_WIDTH; ++x)
+                {
+                    b8 inside = x >= rect[0] && x < rect[2] && y >= rect[1] && y < rect[3];
+                    const pixel *want = inside ? &expected[y * VERIFY_WIDTH + x] : &untouched;
+                    if (memcmp(want, &actual[y * VERIFY_WIDTH + x], sizeof(pixel)) != 0)
+                    {
+                        fprintf(stderr, "pattern fill: %s kernel differs from the reference "
+                            "in %s at offset %d, pixel %d,%d of [%d, %d) x [%d, %d)%s\n",
+                            kernel, pixel_formats[format].name, offset, x, y,
+                            rect[0], rect[2], rect[1], rect[3],
+                            non_temporal ? " with streaming stores" : "");
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+typedef b8 checkerboard_verify_fn(s32 offset, const char *kernel);
+
+global_variable checkerboard_verify_fn *checkerboard_verifies[PIXEL_FORMAT_COUNT] =
+{
+    checkerboard_verify_format<PIXEL_FORMAT_XRGB8888>,
+    checkerboard_verify_format<PIXEL_FORMAT_ARGB8888>,
+    checkerboard_verify_format<PIXEL_FORMAT_RGB565>,
+};
+
+/* Checks every span kernel this CPU can run, not only the selected one,
+ * bit for bit against checkerboard_fill_reference in every pixel format.
+ * Leaves the selected kernel in place. */
+internal b8
+pattern_fill_verify(void)
+{
+    struct
+    {
+        const char *name;
+        pattern_span_fn *fn;
+    } kernels[] =
+    {
+        { "scalar", pattern_span_scalar },
+        { "sse2", pattern_span_sse2 },
+        { "avx2", pattern_span_avx2 },
+        { "avx512", pattern_span_avx512 },
+    };
+
+    __builtin_cpu_init();
+    pattern_span_fn *selected = pattern_span;
+    b8 ok = true;
+    for (u32 k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && ok; ++k)
+    {
+        /* __builtin_cpu_supports only takes string literals */
+        if ((k == 1 && !__builtin_cpu_supports("sse2")) ||
+            (k == 2 && !__builtin_cpu_supports("avx2")) ||
+            (k == 3 && !__builtin_cpu_supports("avx512f")))
+        {
+            continue;
+        }
+        pattern_span = kernels[k].fn;
+        /* Both the columns and the row classes repeat every 16 offsets */
+        for (s32 offset = 0; offset < CHECKER_PERIOD && ok; ++offset)
+        {
+            for (u32 f = 0; f < PIXEL_FORMAT_COUNT && ok; ++f)
+            {
+                ok = checkerboard_verifies[f](offset, kernels[k].name);
+            }
+        }
+    }
+    pattern_span = selected;
+    return ok;
+}
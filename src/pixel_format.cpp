@@ -0,0 +1,175 @@
+/* Pixel formats the renderer can write. What a format means for the
+ * pixels is a compile-time trait, so fills are specialized per format
+ * instead of branching per pixel; the runtime table below is for the code
+ * that only needs sizes and wl_shm or DRM fourcc codes. */
+
+enum pixel_format
+{
+    PIXEL_FORMAT_XRGB8888,
+    PIXEL_FORMAT_ARGB8888,
+    PIXEL_FORMAT_RGB565,
+    PIXEL_FORMAT_COUNT,
+};
+
+/* `pack` takes a non-premultiplied 0xAARRGGBB color */
+template <pixel_format format>
+struct pixel_traits;
+
+template <>
+struct pixel_traits<PIXEL_FORMAT_XRGB8888>
+{
+    typedef u32 pixel;
+    static constexpr u32 wl_format = WL_SHM_FORMAT_XRGB8888;
+    static constexpr u32 drm_format = 0x34325258; /* XR24 */
+    static constexpr b8 alpha = false;
+    static constexpr u32 channel_bits = 8;
+
+    static constexpr pixel
+    pack(u32 argb)
+    {
+        return argb | 0xFF000000u;
+    }
+};
+
+template <>
+struct pixel_traits<PIXEL_FORMAT_ARGB8888>
+{
+    typedef u32 pixel;
+    static constexpr u32 wl_format = WL_SHM_FORMAT_ARGB8888;
+    static constexpr u32 drm_format = 0x34325241; /* AR24 */
+    static constexpr b8 alpha = true;
+    static constexpr u32 channel_bits = 8;
+
+    /* wl_shm alpha is premultiplied */
+    static constexpr pixel
+    pack(u32 argb)
+    {
+        u32 a = argb >> 24;
+        return a << 24 |
+            ((argb >> 16 & 0xFF) * a / 255) << 16 |
+            ((argb >> 8 & 0xFF) * a / 255) << 8 |
+            (argb & 0xFF) * a / 255;
+    }
+};
+
+template <>
+struct pixel_traits<PIXEL_FORMAT_RGB565>
+{
+    typedef u16 pixel;
+    static constexpr u32 wl_format = WL_SHM_FORMAT_RGB565;
+    static constexpr u32 drm_format = 0x36314752; /* RG16 */
+    static constexpr b8 alpha = false;
+    /* Of the narrowest channel, green has 6 */
+    static constexpr u32 channel_bits = 5;
+
+    static constexpr pixel
+    pack(u32 argb)
+    {
+        return (pixel)((argb >> 19 & 0x1F) << 11 | (argb >> 10 & 0x3F) << 5 | (argb >> 3 & 0x1F));
+    }
+};
+
+struct pixel_format_info
+{
+    const char *name;
+    u32 wl_format;
+    u32 drm_format;
+    s32 bytes_per_pixel;
+    b8 alpha;
+    u32 channel_bits;
+};
+
+template <pixel_format format>
+constexpr pixel_format_info
+pixel_format_describe(const char *name)
+{
+    return
+    {
+        name,
+        pixel_traits<format>::wl_format,
+        pixel_traits<format>::drm_format,
+        (s32)sizeof(typename pixel_traits<format>::pixel),
+        pixel_traits<format>::alpha,
+        pixel_traits<format>::channel_bits,
+    };
+}
+
+global_variable constexpr pixel_format_info pixel_formats[PIXEL_FORMAT_COUNT] =
+{
+    pixel_format_describe<PIXEL_FORMAT_XRGB8888>("xrgb8888"),
+    pixel_format_describe<PIXEL_FORMAT_ARGB8888>("argb8888"),
+    pixel_format_describe<PIXEL_FORMAT_RGB565>("rgb565"),
+};
+
+internal s32
+pixel_format_bytes(pixel_format format)
+{
+    return pixel_formats[format].bytes_per_pixel;
+}
+
+/* PIXEL_FORMAT_COUNT for formats the renderer cannot write */
+internal pixel_format
+pixel_format_from_wl(u32 wl_format)
+{
+    for (u32 i = 0; i < PIXEL_FORMAT_COUNT; ++i)
+    {
+        if (pixel_formats[i].wl_format == wl_format)
+        {
+            return (pixel_format)i;
+        }
+    }
+    return PIXEL_FORMAT_COUNT;
+}
+
+/* PIXEL_FORMAT_COUNT for formats the renderer cannot write */
+internal pixel_format
+pixel_format_from_drm(u32 drm_format)
+{
+    for (u32 i = 0; i < PIXEL_FORMAT_COUNT; ++i)
+    {
+        if (pixel_formats[i].drm_format == drm_format)
+        {
+            return (pixel_format)i;
+        }
+    }
+    return PIXEL_FORMAT_COUNT;
+}
+
+/* PIXEL_FORMAT_COUNT for an unknown name */
+internal pixel_format
+pixel_format_from_name(const char *name)
+{
+    for (u32 i = 0; i < PIXEL_FORMAT_COUNT; ++i)
+    {
+        if (strcmp(pixel_formats[i].name, name) == 0)
+        {
+            return (pixel_format)i;
+        }
+    }
+    return PIXEL_FORMAT_COUNT;
+}
+
+/* The cheapest of the `available` formats, a bit per pixel_format, that
+ * carries the content: alpha if it has any and at least `channel_bits`
+ * per color channel. Falls back to XRGB8888, which every wl_shm has. */
+internal pixel_format
+pixel_format_choose(u32 available, b8 alpha, u32 channel_bits)
+{
+    pixel_format best = PIXEL_FORMAT_COUNT;
+    for (u32 i = 0; i < PIXEL_FORMAT_COUNT; ++i)
+    {
+        const pixel_format_info *info = &pixel_formats[i];
+        if (!(available & (1u << i)) ||
+            (alpha && !info->alpha) ||
+            info->channel_bits < channel_bits)
+        {
+            continue;
+        }
+        /* Earlier formats win ties, opaque ones come first */
+        if (best == PIXEL_FORMAT_COUNT || info->bytes_per_pixel < pixel_formats[best].bytes_per_pixel)
+        {
+            best = (pixel_format)i;
+        }
+    }
+    return best == PIXEL_FORMAT_COUNT ? PIXEL_FORMAT_XRGB8888 : best;
+}
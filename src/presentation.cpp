@@ -0,0 +1,310 @@
+#include <time.h>
+
+/* Power of two; older records are overwritten */
+#define PRESENTATION_RING_SIZE 1024
+/* Feedback objects in flight at once. Commits beyond this go untracked. */
+#define PRESENTATION_MAX_PENDING 32
+
+struct presentation_record
+{
+    u64 commit_ns;
+    u64 present_ns;
+    u64 sequence;
+    u32 refresh_ns;
+    u32 flags;
+    b8 discarded;
+};
+
+struct presentation_tracker;
+
+struct presentation_pending
+{
+    presentation_tracker *tracker;
+    struct wp_presentation_feedback *feedback;
+    u64 commit_ns;
+};
+
+struct presentation_stats
+{
+    u64 requested;
+    u64 untracked;
+    u64 presented;
+    u64 discarded;
+    /* Presentations later than the first refresh after their commit */
+    u64 late;
+};
+
+/* Requests wp_presentation feedback for every content commit and keeps the
+ * outcome of the most recent ones. Timestamps are in the presentation
+ * clock announced by the compositor. */
+struct presentation_tracker
+{
+    wp_presentation *wp_presentation;
+    clockid_t clock_id;
+
+    presentation_pending pending[PRESENTATION_MAX_PENDING];
+    presentation_record records[PRESENTATION_RING_SIZE];
+    u64 record_count;
+    /* Latest presentation with a refresh counter, which the refresh a
+     * commit was targeted at is extrapolated from */
+    u64 last_sequence;
+    u64 last_present_ns;
+    /* Latest refresh interval the compositor reported, 0 if none */
+    u32 refresh_ns;
+    presentation_stats stats;
+};
+
+internal u64
+presentation_clock_ns(clockid_t clock_id)
+{
+    timespec ts;
+    clock_gettime(clock_id, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+internal presentation_record *
+presentation_push_record(presentation_tracker *tracker, presentation_pending *pending)
+{
+    presentation_record *record =
+        &tracker->records[tracker->record_count++ & (PRESENTATION_RING_SIZE - 1)];
+    *record = {};
+    record->commit_ns = pending->commit_ns;
+    return record;
+}
+
+internal void
+presentation_pending_finish(presentation_pending *pending)
+{
+    wp_presentation_feedback_destroy(pending->feedback);
+    pending->feedback = NULL;
+}
+
+internal void
+wp_presentation_feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+    wl_output *output)
+{
+    // empty
+}
+
+internal void
+wp_presentation_feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+    u32 tv_sec_hi, u32 tv_sec_lo, u32 tv_nsec, u32 refresh,
+    u32 seq_hi, u32 seq_lo, u32 flags)
+{
+    presentation_pending *pending = (presentation_pending*)data;
+    presentation_tracker *tracker = pending->tracker;
+
+    presentation_record *record = presentation_push_record(tracker, pending);
+    u64 tv_sec = ((u64)tv_sec_hi << 32) | tv_sec_lo;
+    record->present_ns = tv_sec * 1000000000ull + tv_nsec;
+    record->sequence = ((u64)seq_hi << 32) | seq_lo;
+    record->refresh_ns = refresh;
+    record->flags = flags;
+
+    /* Commits only carry feedback when the content changed, so gaps in seq
+     * between them say nothing on their own. A commit is late if it missed
+     * the first refresh after it was made. seq is zero when the output has
+     * no refresh counter, refresh when it has no fixed rate. */
+    if (record->sequence != 0 && tracker->last_sequence != 0 && refresh != 0)
+    {
+        u64 target = tracker->last_sequence + 1;
+        if (record->commit_ns > tracker->last_present_ns)
+        {
+            target += (record->commit_ns - tracker->last_present_ns) / refresh;
+        }
+        if (record->sequence > target)
+        {
+            ++tracker->stats.late;
+        }
+    }
+    if (record->sequence != 0)
+    {
+        tracker->last_sequence = record->sequence;
+        tracker->last_present_ns = record->present_ns;
+    }
+    if (refresh != 0)
+    {
+        tracker->refresh_ns = refresh;
+    }
+    ++tracker->stats.presented;
+    presentation_pending_finish(pending);
+}
+
+internal void
+wp_presentation_feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+    presentation_pending *pending = (presentation_pending*)data;
+    presentation_tracker *tracker = pending->tracker;
+
+    presentation_record *record = presentation_push_record(tracker, pending);
+    record->discarded = true;
+    ++tracker->stats.discarded;
+    presentation_pending_finish(pending);
+}
+
+global_variable wp_presentation_feedback_listener wp_presentation_feedback_listener =
+{
+    .sync_output = wp_presentation_feedback_sync_output,
+    .presented = wp_presentation_feedback_presented,
+    .discarded = wp_presentation_feedback_discarded,
+};
+
+/* wp_presentation.clock_id is sent as soon as the global is bound, so the
+ * listener goes on in the bind handler, ahead of the tracker */
+internal void
+wp_presentation_clock_id(void *data, wp_presentation *wp_presentation, u32 clk_id)
+{
+    clockid_t *clock_id = (clockid_t*)data;
+    *clock_id = (clockid_t)clk_id;
+}
+
+global_variable wp_presentation_listener wp_presentation_listener =
+{
+    .clock_id = wp_presentation_clock_id,
+};
+
+/* `clock_id` is CLOCK_MONOTONIC until the compositor names its clock */
+internal void
+presentation_listen(wp_presentation *wp_presentation, clockid_t *clock_id)
+{
+    *clock_id = CLOCK_MONOTONIC;
+    wp_presentation_add_listener(wp_presentation, &wp_presentation_listener, clock_id);
+}
+
+/* `clock_id` is the one wp_presentation.clock_id announced */
+internal void
+presentation_tracker_init(presentation_tracker *tracker, wp_presentation *wp_presentation,
+    clockid_t clock_id)
+{
+    *tracker = {};
+    tracker->clock_id = clock_id;
+    tracker->wp_presentation = wp_presentation;
+    for (u32 i = 0; i < PRESENTATION_MAX_PENDING; ++i)
+    {
+        tracker->pending[i].tracker = tracker;
+    }
+}
+
+/* Call right before wl_surface_commit for a commit that carries new
+ * content. Does nothing when the compositor lacks wp_presentation. */
+internal void
+presentation_track_commit(presentation_tracker *tracker, wl_surface *surface)
+{
+    if (!tracker->wp_presentation)
+    {
+        return;
+    }
+
+    ++tracker->stats.requested;
+    presentation_pending *pending = NULL;
+    for (u32 i = 0; i < PRESENTATION_MAX_PENDING; ++i)
+    {
+        if (!tracker->pending[i].feedback)
+        {
+            pending = &tracker->pending[i];
+            break;
+        }
+    }
+    if (!pending)
+    {
+        ++tracker->stats.untracked;
+        return;
+    }
+
+    pending->feedback = wp_presentation_feedback(tracker->wp_presentation, surface);
+    wp_presentation_feedback_add_listener(pending->feedback,
+        &wp_presentation_feedback_listener, pending);
+    pending->commit_ns = presentation_clock_ns(tracker->clock_id);
+}
+
+internal void
+presentation_tracker_destroy(presentation_tracker *tracker)
+{
+    for (u32 i = 0; i < PRESENTATION_MAX_PENDING; ++i)
+    {
+        if (tracker->pending[i].feedback)
+        {
+            presentation_pending_finish(&tracker->pending[i]);
+        }
+    }
+    if (tracker->wp_presentation)
+    {
+        wp_presentation_destroy(tracker->wp_presentation);
+        tracker->wp_presentation = NULL;
+    }
+}
+
+/* Summarizes the records still in the ring: commit-to-present latency,
+ * the refresh interval reported by the compositor and the measured
+ * interval between consecutive presentations */
+internal void
+presentation_print_stats(presentation_tracker *tracker)
+{
+    if (!tracker->wp_presentation && tracker->stats.requested == 0)
+    {
+        fprintf(stderr, "presentation: wp_presentation not supported\n");
+        return;
+    }
+
+    fprintf(stderr, "presentation: %llu feedbacks (%llu untracked), %llu presented, "
+        "%llu discarded, %llu late\n",
+        (unsigned long long)tracker->stats.requested,
+        (unsigned long long)tracker->stats.untracked,
+        (unsigned long long)tracker->stats.presented,
+        (unsigned long long)tracker->stats.discarded,
+        (unsigned long long)tracker->stats.late
+    );
+
+    u64 count = tracker->record_count < PRESENTATION_RING_SIZE
+        ? tracker->record_count : PRESENTATION_RING_SIZE;
+    u64 first = tracker->record_count - count;
+
+    local_persist u64 latencies[PRESENTATION_RING_SIZE];
+    u64 latency_count = 0;
+    u64 refresh_sum = 0;
+    u64 refresh_count = 0;
+    u64 interval_sum = 0;
+    u64 interval_count = 0;
+    u64 last_present = 0;
+    for (u64 i = first; i < tracker->record_count; ++i)
+    {
+        presentation_record *record = &tracker->records[i & (PRESENTATION_RING_SIZE - 1)];
+        if (record->discarded)
+        {
+            continue;
+        }
+        if (record->present_ns >= record->commit_ns)
+        {
+            latencies[latency_count++] = record->present_ns - record->commit_ns;
+        }
+        if (record->refresh_ns)
+        {
+            refresh_sum += record->refresh_ns;
+            ++refresh_count;
+        }
+        if (last_present && record->present_ns > last_present)
+        {
+            interval_sum += record->present_ns - last_present;
+            ++interval_count;
+        }
+        last_present = record->present_ns;
+    }
+
+    if (latency_count == 0)
+    {
+        return;
+    }
+    qsort(latencies, latency_count, sizeof(latencies[0]), compare_u64);
+    fprintf(stderr, "presentation: latency over last %llu frames: min %.3f ms, "
+        "median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        (unsigned long long)latency_count,
+        latencies[0] / 1e6,
+        latencies[latency_count / 2] / 1e6,
+        latencies[(latency_count - 1) * 99 / 100] / 1e6,
+        latencies[latency_count - 1] / 1e6
+    );
+    fprintf(stderr, "presentation: refresh %.3f ms reported, %.3f ms measured\n",
+        refresh_count ? (f64)refresh_sum / refresh_count / 1e6 : 0.0,
+        interval_count ? (f64)interval_sum / interval_count / 1e6 : 0.0
+    );
+}
@@ -0,0 +1,218 @@
+/* Where drawn frames go. The content code asks the active backend for a
+ * buffer, draws into it and hands it back to present, without knowing
+ * whether that ends in a wl_surface commit or in memory nobody reads. */
+
+struct render_backend
+{
+    const char *name;
+    void *data;
+    /* A buffer of the given size to draw into, NULL when none is free. A
+     * buffer whose content_offset already equals `offset` holds that
+     * frame and needs no drawing. */
+    pool_buffer *(*acquire)(void *data, s32 width, s32 height, s32 offset);
+    /* `buffer` is NULL when the content did not change. The damage is in
+     * buffer coordinates and is cleared once consumed. */
+    void (*present)(void *data, pool_buffer *buffer, damage_region *damage);
+    /* Shows the buffers presented from now on at `width` x `height` in
+     * surface coordinates, whatever their own size. NULL when the backend
+     * cannot scale. */
+    void (*set_destination)(void *data, s32 width, s32 height);
+    /* ns between the refreshes frames are paced to, 0 while unknown */
+    u64 (*refresh_interval)(void *data);
+    void (*print_stats)(void *data);
+    void (*destroy)(void *data);
+};
+
+///
+/// wl_surface
+///
+
+/* Buffers from the shm pool, or from the frame cache when enabled,
+ * committed to a wl_surface with presentation feedback. The pool's
+ * storage can be shared as udmabufs instead of wl_shm. With a wp_viewport
+ * they can be smaller than the surface and are scaled up by the
+ * compositor. */
+struct surface_backend
+{
+    wl_display *wl_display;
+    wl_surface *wl_surface;
+    buffer_pool buffer_pool;
+    frame_cache frame_cache;
+    b8 use_frame_cache;
+    presentation_tracker presentation;
+    wp_viewport *wp_viewport;
+    s32 destination_width;
+    s32 destination_height;
+    /* What a cached frame is handed out as. Every phase shares it, so the
+     * content code never sees stale pixels in a different buffer to
+     * scroll from. */
+    pool_buffer cache_view;
+    cached_frame *cache_frame;
+    /* The pool buffer last presented, which the content code may scroll
+     * from while the compositor still holds it, and whether its read is
+     * bracketed until the next present */
+    pool_buffer *front;
+    b8 reading_front;
+};
+
+/* Acquiring may have reshaped or replaced the front buffer, in which case
+ * it holds no frame left to scroll from */
+internal void
+surface_backend_begin_front_read(surface_backend *backend, pool_buffer *buffer)
+{
+    pool_buffer *front = backend->front;
+    if (front && front != buffer && front->content_offset >= 0 && !backend->reading_front)
+    {
+        pool_buffer_begin_read(front);
+        backend->reading_front = true;
+    }
+}
+
+internal pool_buffer *
+surface_backend_acquire(void *data, s32 width, s32 height, s32 offset)
+{
+    surface_backend *backend = (surface_backend*)data;
+    if (backend->use_frame_cache)
+    {
+        cached_frame *frame = frame_cache_lookup(&backend->frame_cache, width, height, offset);
+        if (frame)
+        {
+            pool_buffer *view = &backend->cache_view;
+            view->wl_buffer = frame->wl_buffer;
+            view->data = frame->data;
+            view->width = width;
+            view->height = height;
+            view->stride = backend->frame_cache.stride;
+            view->format = backend->frame_cache.format;
+            view->size = (size_t)view->stride * height;
+            view->content_offset = frame->rendered ? offset : -1;
+            backend->cache_frame = frame;
+            surface_backend_begin_front_read(backend, view);
+            return view;
+        }
+    }
+    backend->cache_frame = NULL;
+    pool_buffer *buffer = buffer_pool_acquire(&backend->buffer_pool, width, height);
+    if (buffer)
+    {
+        pool_buffer_begin_access(buffer);
+        surface_backend_begin_front_read(backend, buffer);
+    }
+    return buffer;
+}
+
+/* The commit is sent even without a buffer so that pending state and
+ * frame callbacks are applied */
+internal void
+surface_backend_present(void *data, pool_buffer *buffer, damage_region *damage)
+{
+    surface_backend *backend = (surface_backend*)data;
+    if (backend->reading_front)
+    {
+        pool_buffer_end_read(backend->front);
+        backend->reading_front = false;
+    }
+    if (buffer)
+    {
+        if (buffer == &backend->cache_view)
+        {
+            backend->cache_frame->rendered = true;
+            backend->cache_frame->held = true;
+            backend->front = NULL;
+        }
+        else
+        {
+            pool_buffer_end_access(buffer);
+            backend->front = buffer;
+        }
+        wl_surface_attach(backend->wl_surface, buffer->wl_buffer, 0, 0);
+        presentation_track_commit(&backend->presentation, backend->wl_surface);
+    }
+    damage_region_submit(damage, backend->wl_surface);
+    TRACE_FRAME_STAGE(FRAME_STAGE_ATTACH);
+    wl_surface_commit(backend->wl_surface);
+    TRACE_FRAME_STAGE(FRAME_STAGE_COMMIT);
+    /* Send the frame now rather than when the loop next blocks */
+    wl_display_flush(backend->wl_display);
+    TRACE_FRAME_STAGE(FRAME_STAGE_FLUSH);
+}
+
+/* Viewport state is double-buffered, so this lands with the next commit */
+internal void
+surface_backend_set_destination(void *data, s32 width, s32 height)
+{
+    surface_backend *backend = (surface_backend*)data;
+    if (width != backend->destination_width || height != backend->destination_height)
+    {
+        wp_viewport_set_destination(backend->wp_viewport, width, height);
+        backend->destination_width = width;
+        backend->destination_height = height;
+    }
+}
+
+internal u64
+surface_backend_refresh_interval(void *data)
+{
+    surface_backend *backend = (surface_backend*)data;
+    return backend->presentation.refresh_ns;
+}
+
+internal void
+surface_backend_print_stats(void *data)
+{
+    surface_backend *backend = (surface_backend*)data;
+    buffer_pool_print_stats(&backend->buffer_pool);
+    if (backend->use_frame_cache)
+    {
+        frame_cache_print_stats(&backend->frame_cache);
+    }
+    presentation_print_stats(&backend->presentation);
+}
+
+internal void
+surface_backend_destroy(void *data)
+{
+    surface_backend *backend = (surface_backend*)data;
+    presentation_tracker_destroy(&backend->presentation);
+    if (backend->wp_viewport)
+    {
+        wp_viewport_destroy(backend->wp_viewport);
+    }
+    frame_cache_invalidate(&backend->frame_cache);
+    buffer_pool_destroy(&backend->buffer_pool);
+}
+
+internal render_backend
+surface_backend_init(surface_backend *backend, wl_display *wl_display, wl_surface *wl_surface,
+    wl_shm *wl_shm, zwp_linux_dmabuf_v1 *linux_dmabuf, wp_presentation *wp_presentation,
+    clockid_t presentation_clock, wp_viewporter *wp_viewporter, pixel_format format,
+    u32 buffer_count, b8 huge_pages, b8 use_frame_cache, u32 frame_cache_mb)
+{
+    *backend = {};
+    backend->wl_display = wl_display;
+    backend->wl_surface = wl_surface;
+    buffer_pool_init(&backend->buffer_pool, wl_shm, buffer_count, format);
+    backend->buffer_pool.huge_pages = huge_pages;
+    if (linux_dmabuf && !buffer_pool_enable_dmabuf(&backend->buffer_pool, linux_dmabuf))
+    {
+        fprintf(stderr, "dmabuf: /dev/udmabuf is not available, using wl_shm\n");
+    }
+    backend->use_frame_cache = use_frame_cache;
+    frame_cache_init(&backend->frame_cache, wl_shm, format, (size_t)frame_cache_mb << 20);
+    presentation_tracker_init(&backend->presentation, wp_presentation, presentation_clock);
+    if (wp_viewporter)
+    {
+        backend->wp_viewport = wp_viewporter_get_viewport(wp_viewporter, wl_surface);
+    }
+
+    render_backend result = {};
+    result.name = backend->buffer_pool.linux_dmabuf ? "linux-dmabuf" : "wl_shm";
+    result.data = backend;
+    result.acquire = surface_backend_acquire;
+    result.present = surface_backend_present;
+    result.set_destination = backend->wp_viewport ? surface_backend_set_destination : NULL;
+    result.refresh_interval = surface_backend_refresh_interval;
+    result.print_stats = surface_backend_print_stats;
+    result.destroy = surface_backend_destroy;
+    return result;
+}
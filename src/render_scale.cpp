@@ -0,0 +1,173 @@
+/* Dynamic resolution. Picks the fraction of the logical surface size that
+ * frames are rasterized at, from how long rasterizing takes against the
+ * refresh interval, and leaves scaling back up to the compositor through
+ * wp_viewport. Lowering reacts within a few frames since every late frame
+ * is visible; raising waits for a long run of frames that would still fit
+ * at the larger size, so the scale does not flip back and forth around
+ * the threshold. */
+
+/* Largest first, in eighths of the logical size */
+global_variable const u32 render_scale_eighths[] = { 8, 7, 6, 5, 4 };
+#define RENDER_SCALE_LEVELS (sizeof(render_scale_eighths) / sizeof(render_scale_eighths[0]))
+
+/* Used until the backend knows the refresh interval */
+#define RENDER_SCALE_DEFAULT_INTERVAL_NS (1000000000ull / 60)
+/* Raster time over this share of the interval, in percent, is over
+ * budget. The rest is left to the compositor and to scheduling noise. */
+#define RENDER_SCALE_HIGH_PERCENT 75
+/* A step up is only taken when the raster time predicted there, from the
+ * pixel count, stays under this share */
+#define RENDER_SCALE_LOW_PERCENT 50
+#define RENDER_SCALE_DOWN_FRAMES 4
+#define RENDER_SCALE_UP_FRAMES 120
+/* Frames after a change that are not measured, while buffers of the new
+ * size are allocated and first touched */
+#define RENDER_SCALE_SETTLE_FRAMES 8
+
+struct render_scale_stats
+{
+    u64 measured;
+    u64 over_budget;
+    u64 lowered;
+    u64 raised;
+    u64 frames[RENDER_SCALE_LEVELS];
+};
+
+struct render_scale
+{
+    b8 enabled;
+    /* Index into render_scale_eighths */
+    u32 level;
+    u32 over_count;
+    u32 under_count;
+    u32 settle;
+    render_scale_stats stats;
+};
+
+internal void
+render_scale_init(render_scale *scale, b8 enabled)
+{
+    *scale = {};
+    scale->enabled = enabled;
+}
+
+internal f64
+render_scale_factor(u32 level)
+{
+    return render_scale_eighths[level] / 8.0;
+}
+
+/* The buffer size for a logical size at the current scale, never 0 */
+internal s32
+render_scale_size(render_scale *scale, s32 logical)
+{
+    s32 size = (s32)((s64)logical * render_scale_eighths[scale->level] / 8);
+    return size > 0 ? size : 1;
+}
+
+internal void
+render_scale_change(render_scale *scale, u32 level, u64 raster_ns, u64 interval_ns)
+{
+    fprintf(stderr, "render scale: %.3f -> %.3f, raster %.2f ms against a %.2f ms refresh\n",
+        render_scale_factor(scale->level),
+        render_scale_factor(level),
+        raster_ns / 1e6,
+        interval_ns / 1e6
+    );
+    if (level > scale->level)
+    {
+        ++scale->stats.lowered;
+    }
+    else
+    {
+        ++scale->stats.raised;
+    }
+    scale->level = level;
+    scale->over_count = 0;
+    scale->under_count = 0;
+    scale->settle = RENDER_SCALE_SETTLE_FRAMES;
+}
+
+/* Feeds the time one frame took to rasterize at the current scale, with
+ * the refresh interval or 0 if it is not known. Frames that were not
+ * rasterized, e.g. served from a cache, should not be recorded. Returns
+ * true when the scale changed, which takes effect from the next frame. */
+internal b8
+render_scale_record(render_scale *scale, u64 raster_ns, u64 interval_ns)
+{
+    if (!scale->enabled)
+    {
+        return false;
+    }
+    ++scale->stats.frames[scale->level];
+    if (scale->settle)
+    {
+        --scale->settle;
+        return false;
+    }
+    if (interval_ns == 0)
+    {
+        interval_ns = RENDER_SCALE_DEFAULT_INTERVAL_NS;
+    }
+    ++scale->stats.measured;
+
+    if (raster_ns * 100 > interval_ns * RENDER_SCALE_HIGH_PERCENT)
+    {
+        ++scale->stats.over_budget;
+        scale->under_count = 0;
+        if (++scale->over_count >= RENDER_SCALE_DOWN_FRAMES &&
+            scale->level + 1 < RENDER_SCALE_LEVELS)
+        {
+            render_scale_change(scale, scale->level + 1, raster_ns, interval_ns);
+            return true;
+        }
+        return false;
+    }
+    scale->over_count = 0;
+
+    if (scale->level == 0)
+    {
+        return false;
+    }
+    /* Raster time goes with the pixel count, the square of the scale */
+    u64 up = render_scale_eighths[scale->level - 1];
+    u64 now = render_scale_eighths[scale->level];
+    u64 predicted_ns = raster_ns * up * up / (now * now);
+    if (predicted_ns * 100 < interval_ns * RENDER_SCALE_LOW_PERCENT)
+    {
+        if (++scale->under_count >= RENDER_SCALE_UP_FRAMES)
+        {
+            render_scale_change(scale, scale->level - 1, raster_ns, interval_ns);
+            return true;
+        }
+    }
+    else
+    {
+        scale->under_count = 0;
+    }
+    return false;
+}
+
+internal void
+render_scale_print_stats(render_scale *scale)
+{
+    if (!scale->enabled)
+    {
+        return;
+    }
+    fprintf(stderr, "render scale: %.3f at exit, %llu lowered, %llu raised, "
+        "%llu of %llu measured frames over budget\n",
+        render_scale_factor(scale->level),
+        (unsigned long long)scale->stats.lowered,
+        (unsigned long long)scale->stats.raised,
+        (unsigned long long)scale->stats.over_budget,
+        (unsigned long long)scale->stats.measured
+    );
+    fprintf(stderr, "render scale: frames rasterized at");
+    for (u32 i = 0; i < RENDER_SCALE_LEVELS; ++i)
+    {
+        fprintf(stderr, " %.3f: %llu%s", render_scale_factor(i),
+            (unsigned long long)scale->stats.frames[i],
+            i + 1 < RENDER_SCALE_LEVELS ? "," : "\n");
+    }
+}
@@ -0,0 +1,88 @@
+enum render_mode
+{
+    RENDER_MODE_FULL,
+    /* Reuse the previous frame shifted by the animation delta */
+    RENDER_MODE_SCROLL,
+};
+
+struct render_stats
+{
+    u64 frames;
+    u64 rasterized;
+    u64 copied;
+    u64 last_rasterized;
+    u64 last_copied;
+};
+
+internal void
+render_stats_frame(render_stats *stats, u64 rasterized, u64 copied)
+{
+    ++stats->frames;
+    stats->rasterized += rasterized;
+    stats->copied += copied;
+    stats->last_rasterized = rasterized;
+    stats->last_copied = copied;
+}
+
+internal void
+render_stats_print(render_stats *stats)
+{
+    u64 frames = stats->frames ? stats->frames : 1;
+    fprintf(stderr, "render: %llu frames, %llu pixels rasterized, %llu copied "
+        "(%llu / %llu per frame)\n",
+        (unsigned long long)stats->frames,
+        (unsigned long long)stats->rasterized,
+        (unsigned long long)stats->copied,
+        (unsigned long long)(stats->rasterized / frames),
+        (unsigned long long)(stats->copied / frames)
+    );
+}
+
+/* Moves `rows` rows of `bytes` each. Rows are walked top to bottom, which is
+ * safe in place as long as the source never lies above the destination;
+ * memmove handles the overlap within a row and is already vectorized. */
+internal void
+scroll_move_rows(u8 *dst, const u8 *src, s32 stride, s32 rows, size_t bytes)
+{
+    for (s32 y = 0; y < rows; ++y)
+    {
+        memmove(dst + (size_t)y * stride, src + (size_t)y * stride, bytes);
+    }
+}
+
+/* Produces the checkerboard at `offset` in `dst` from `src`, which holds
+ * the same size at `src->content_offset`. The pattern repeats every 8
+ * offsets and moving it by d shows what was at (x + d, y + d), so the old
+ * frame is shifted up and left and only the bottom and right strips that
+ * scroll in are rasterized. `src` may be `dst`. */
+internal void
+checkerboard_scroll(pool_buffer *dst, pool_buffer *src, s32 offset, render_stats *stats)
+{
+    s32 width = dst->width;
+    s32 height = dst->height;
+    s32 delta = (offset - src->content_offset) & 7;
+
+    if (delta == 0)
+    {
+        if (dst != src)
+        {
+            memcpy(dst->data, src->data, (size_t)dst->stride * height);
+        }
+        render_stats_frame(stats, 0, (u64)width * height);
+        return;
+    }
+
+    s32 keep_w = width > delta ? width - delta : 0;
+    s32 keep_h = height > delta ? height - delta : 0;
+
+    s32 bytes = pixel_format_bytes(dst->format);
+    u8 *dst_data = (u8*)dst->data;
+    const u8 *src_data = (const u8*)src->data + (size_t)delta * src->stride + (size_t)delta * bytes;
+    scroll_move_rows(dst_data, src_data, dst->stride, keep_h, (size_t)keep_w * bytes);
+
+    checkerboard_fill(dst_data, dst->stride, keep_w, 0, width, keep_h, offset, dst->format);
+    checkerboard_fill(dst_data, dst->stride, 0, keep_h, width, height, offset, dst->format);
+
+    u64 copied = (u64)keep_w * keep_h;
+    render_stats_frame(stats, (u64)width * height - copied, copied);
+}
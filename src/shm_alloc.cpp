@@ -1,9 +1,24 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
+enum shm_alloc_flags {
+	/* Back the file with huge pages when the system allows it */
+	SHM_ALLOC_HUGE = 1 << 0,
+};
+
+enum shm_backend {
+	SHM_BACKEND_UNKNOWN,
+	SHM_BACKEND_MEMFD,
+	SHM_BACKEND_SHM_OPEN,
+};
+
+static enum shm_backend shm_backend = SHM_BACKEND_UNKNOWN;
+static size_t shm_huge_page_size;
+
 static void
 randname(char *buf)
 {
@@ -33,19 +48,128 @@ create_shm_file(void)
 	return -1;
 }
 
+static size_t
+get_huge_page_size(void)
+{
+	if (shm_huge_page_size)
+		return shm_huge_page_size;
+
+	shm_huge_page_size = 2 * 1024 * 1024;
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	if (!meminfo)
+		return shm_huge_page_size;
+
+	char line[128];
+	unsigned long kb;
+	while (fgets(line, sizeof(line), meminfo)) {
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			shm_huge_page_size = kb * 1024;
+			break;
+		}
+	}
+	fclose(meminfo);
+	return shm_huge_page_size;
+}
+
+#ifdef MFD_CLOEXEC
+static int
+create_memfd(unsigned int flags)
+{
+	unsigned int mfd_flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+	if (flags & SHM_ALLOC_HUGE)
+		mfd_flags |= MFD_HUGETLB;
+	return memfd_create("wl_shm", mfd_flags);
+}
+#endif
+
+/* Picks memfd when the kernel has it and falls back to shm_open, which
+ * needs a unique name and may retry on collisions. With SHM_ALLOC_HUGE the
+ * size is rounded up to whole huge pages, so callers must map and share the
+ * returned size. */
+static int
+create_shm_file_flags(size_t *size, unsigned int flags)
+{
+#ifdef MFD_CLOEXEC
+	if (shm_backend != SHM_BACKEND_SHM_OPEN) {
+		if (flags & SHM_ALLOC_HUGE) {
+			size_t page = get_huge_page_size();
+			size_t huge_size = (*size + page - 1) / page * page;
+			int fd = create_memfd(flags);
+			if (fd >= 0) {
+				int ret;
+				do {
+					ret = ftruncate(fd, huge_size);
+				} while (ret < 0 && errno == EINTR);
+				/* hugetlb pages are reserved at mmap time and the
+				 * reservation stays with the file, so probe it once
+				 * here instead of failing in the caller's mmap */
+				void *probe = MAP_FAILED;
+				if (ret == 0)
+					probe = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, fd, 0);
+				if (probe != MAP_FAILED) {
+					munmap(probe, huge_size);
+					shm_backend = SHM_BACKEND_MEMFD;
+					*size = huge_size;
+					return fd;
+				}
+				close(fd);
+			}
+			/* No hugetlb pages available, use regular pages */
+		}
+
+		int fd = create_memfd(0);
+		if (fd >= 0) {
+			shm_backend = SHM_BACKEND_MEMFD;
+			return fd;
+		}
+		if (errno != ENOSYS && errno != EINVAL)
+			return -1;
+		shm_backend = SHM_BACKEND_SHM_OPEN;
+	}
+#endif
+	return create_shm_file();
+}
+
+static void
+seal_shm_file(int fd)
+{
+#ifdef F_ADD_SEALS
+	if (shm_backend == SHM_BACKEND_MEMFD)
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+}
+
 int
-allocate_shm_file(size_t size)
+allocate_shm_file_flags(size_t *size, unsigned int flags)
 {
-	int fd = create_shm_file();
+	int fd = create_shm_file_flags(size, flags);
 	if (fd < 0)
 		return -1;
 	int ret;
 	do {
-		ret = ftruncate(fd, size);
+		ret = ftruncate(fd, *size);
 	} while (ret < 0 && errno == EINTR);
 	if (ret < 0) {
 		close(fd);
 		return -1;
 	}
+	seal_shm_file(fd);
 	return fd;
 }
+
+int
+allocate_shm_file(size_t size)
+{
+	return allocate_shm_file_flags(&size, 0);
+}
+
+/* Ask for transparent huge pages on a mapping. Only has an effect for
+ * shmem when /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it */
+void
+shm_advise_huge(void *data, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	madvise(data, size, MADV_HUGEPAGE);
+#endif
+}
@@ -0,0 +1,289 @@
+#include <pthread.h>
+#include <sched.h>
+
+#define THREAD_POOL_MAX_THREADS 32
+/* Power of two, per thread */
+#define WORK_DEQUE_SIZE 256
+
+/* Runs the half-open index range [begin, end) of a job */
+typedef void work_fn(void *data, s32 begin, s32 end);
+
+struct work_item
+{
+    work_fn *fn;
+    void *data;
+    s32 begin;
+    s32 end;
+};
+
+/* The owning thread pushes and pops at the tail, other threads steal from
+ * the head. Jobs are a handful of coarse items, so a spinlock per deque is
+ * cheaper than it sounds and keeps the owner and thieves simple. */
+struct work_deque
+{
+    alignas(64) s32 lock;
+    u32 head;
+    u32 tail;
+    work_item items[WORK_DEQUE_SIZE];
+};
+
+struct thread_pool_stats
+{
+    u64 jobs;
+    u64 inline_jobs;
+    u64 items;
+    u64 steals;
+};
+
+struct thread_pool
+{
+    /* Includes the thread calling thread_pool_run, which owns deque 0 */
+    u32 thread_count;
+    pthread_t threads[THREAD_POOL_MAX_THREADS];
+    work_deque deques[THREAD_POOL_MAX_THREADS];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    u32 generation;
+    b8 quit;
+
+    s32 pending;
+    thread_pool_stats stats;
+};
+
+struct thread_pool_worker
+{
+    thread_pool *pool;
+    u32 index;
+};
+
+global_variable thread_pool_worker thread_pool_workers[THREAD_POOL_MAX_THREADS];
+
+internal void
+work_deque_lock(work_deque *deque)
+{
+    while (__atomic_test_and_set(&deque->lock, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(&deque->lock, __ATOMIC_RELAXED))
+        {
+            __builtin_ia32_pause();
+        }
+    }
+}
+
+internal void
+work_deque_unlock(work_deque *deque)
+{
+    __atomic_clear(&deque->lock, __ATOMIC_RELEASE);
+}
+
+internal b8
+work_deque_push(work_deque *deque, work_item item)
+{
+    b8 pushed = false;
+    work_deque_lock(deque);
+    if (deque->tail - deque->head < WORK_DEQUE_SIZE)
+    {
+        deque->items[deque->tail++ & (WORK_DEQUE_SIZE - 1)] = item;
+        pushed = true;
+    }
+    work_deque_unlock(deque);
+    return pushed;
+}
+
+internal b8
+work_deque_pop(work_deque *deque, work_item *item)
+{
+    b8 popped = false;
+    work_deque_lock(deque);
+    if (deque->tail != deque->head)
+    {
+        *item = deque->items[--deque->tail & (WORK_DEQUE_SIZE - 1)];
+        popped = true;
+    }
+    work_deque_unlock(deque);
+    return popped;
+}
+
+internal b8
+work_deque_steal(work_deque *deque, work_item *item)
+{
+    b8 stolen = false;
+    work_deque_lock(deque);
+    if (deque->tail != deque->head)
+    {
+        *item = deque->items[deque->head++ & (WORK_DEQUE_SIZE - 1)];
+        stolen = true;
+    }
+    work_deque_unlock(deque);
+    return stolen;
+}
+
+/* Runs items from the thread's own deque, then steals from the others.
+ * Returns once no deque has work left. */
+internal void
+thread_pool_drain(thread_pool *pool, u32 index)
+{
+    work_item item;
+    for (;;)
+    {
+        b8 found = work_deque_pop(&pool->deques[index], &item);
+        for (u32 i = 1; !found && i < pool->thread_count; ++i)
+        {
+            u32 victim = (index + i) % pool->thread_count;
+            found = work_deque_steal(&pool->deques[victim], &item);
+            if (found)
+            {
+                __atomic_add_fetch(&pool->stats.steals, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (!found)
+        {
+            return;
+        }
+
+        item.fn(item.data, item.begin, item.end);
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+internal void *
+thread_pool_worker_main(void *data)
+{
+    thread_pool_worker *worker = (thread_pool_worker*)data;
+    thread_pool *pool = worker->pool;
+    u32 seen = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == seen && !pool->quit)
+        {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        seen = pool->generation;
+        b8 quit = pool->quit;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (quit)
+        {
+            return NULL;
+        }
+        thread_pool_drain(pool, worker->index);
+    }
+}
+
+/* thread_count 0 uses one thread per online CPU */
+internal void
+thread_pool_init(thread_pool *pool, u32 thread_count)
+{
+    *pool = {};
+    if (thread_count == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (u32)cpus : 1;
+    }
+    if (thread_count > THREAD_POOL_MAX_THREADS)
+    {
+        thread_count = THREAD_POOL_MAX_THREADS;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    pool->thread_count = 1;
+    for (u32 i = 1; i < thread_count; ++i)
+    {
+        thread_pool_worker *worker = &thread_pool_workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker_main, worker) != 0)
+        {
+            break;
+        }
+        pool->thread_count = i + 1;
+    }
+}
+
+internal void
+thread_pool_destroy(thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (u32 i = 1; i < pool->thread_count; ++i)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+/* Splits [0, count) into items of at least `grain` indices, spreads them
+ * over the deques and helps running them. Returns once every item has
+ * finished, so the results are visible to the caller. Jobs with fewer than
+ * `min_parallel` indices run inline on the calling thread. */
+internal void
+thread_pool_run(thread_pool *pool, work_fn *fn, void *data, s32 count,
+    s32 grain, s32 min_parallel)
+{
+    ++pool->stats.jobs;
+    if (pool->thread_count == 1 || count < min_parallel)
+    {
+        ++pool->stats.inline_jobs;
+        fn(data, 0, count);
+        return;
+    }
+
+    s32 max_items = (s32)pool->thread_count * WORK_DEQUE_SIZE;
+    if (grain < 1)
+    {
+        grain = 1;
+    }
+    if ((count + grain - 1) / grain > max_items)
+    {
+        grain = (count + max_items - 1) / max_items;
+    }
+
+    s32 items = (count + grain - 1) / grain;
+    __atomic_store_n(&pool->pending, items, __ATOMIC_RELAXED);
+    pool->stats.items += items;
+
+    /* Contiguous runs per thread keep neighbouring rows on one core */
+    s32 per_thread = (items + pool->thread_count - 1) / pool->thread_count;
+    for (s32 i = 0; i < items; ++i)
+    {
+        work_item item;
+        item.fn = fn;
+        item.data = data;
+        item.begin = i * grain;
+        item.end = item.begin + grain < count ? item.begin + grain : count;
+        work_deque_push(&pool->deques[i / per_thread], item);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    thread_pool_drain(pool, 0);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+    {
+        __builtin_ia32_pause();
+    }
+}
+
+internal void
+thread_pool_print_stats(thread_pool *pool)
+{
+    fprintf(stderr, "thread pool: %u threads, %llu jobs (%llu inline), "
+        "%llu items, %llu steals\n",
+        pool->thread_count,
+        (unsigned long long)pool->stats.jobs,
+        (unsigned long long)pool->stats.inline_jobs,
+        (unsigned long long)pool->stats.items,
+        (unsigned long long)pool->stats.steals
+    );
+}
@@ -0,0 +1,54 @@
+/* CPU-only dmabufs. /dev/udmabuf turns the pages of a sealed memfd into a
+ * dmabuf without any GPU driver involved, which a compositor can import
+ * like any other linear buffer instead of copying out of wl_shm. The
+ * pixels stay where the memfd mapping already has them. */
+
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+#include <sys/ioctl.h>
+
+/* From drm_fourcc.h, plain row-major pixels */
+#define DRM_FORMAT_MOD_LINEAR 0ull
+
+/* -1 when the kernel has no udmabuf driver or the device is not
+ * accessible */
+internal int
+udmabuf_open(void)
+{
+    return open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+}
+
+/* A dmabuf over the first `size` bytes of `memfd`, -1 on failure. The
+ * memfd must be sealed against shrinking but not against writes, as
+ * allocate_shm_file_flags leaves it, and `size` must be whole pages. The
+ * dmabuf holds its own reference to the pages, so the memfd can be closed
+ * afterwards. */
+internal int
+udmabuf_wrap(int udmabuf_fd, int memfd, size_t size)
+{
+    struct udmabuf_create create = {};
+    create.memfd = memfd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = size;
+    int fd;
+    do
+    {
+        fd = ioctl(udmabuf_fd, UDMABUF_CREATE, &create);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+/* Brackets CPU access to a dmabuf, `flags` is DMA_BUF_SYNC_START or
+ * DMA_BUF_SYNC_END with the access direction. A no-op on coherent
+ * hardware, but the protocol leaves coherency to the client. */
+internal void
+dmabuf_sync(int dmabuf_fd, u64 flags)
+{
+    struct dma_buf_sync sync = {};
+    sync.flags = flags;
+    while (ioctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0 &&
+        (errno == EINTR || errno == EAGAIN))
+    {
+    }
+}